@@ -1,8 +1,9 @@
 #!/bin/sh
 set -e
 
+# Compiled into initializer lists that src/shader.c includes, so the binary carries its shaders
 for shader in shader/*.frag shader/*.vert; do
-	glslc "$shader" -o "${shader}.spv"
+	glslc -mfmt=c "$shader" -o "${shader}.inc"
 done
 
 if [ "$1" = "shader" ]; then
@@ -1,10 +1,10 @@
 #version 450
 layout(location = 0) out vec4 colour;
 layout(location = 0) in vec2 tex_coord;
+layout(location = 1) in vec4 text_colour;
 
 layout(binding = 0) uniform sampler2D glyph_sampler;
 
 void main() {
-	vec3 text_colour = vec3(1.0);
-	colour = vec4(text_colour, texture(glyph_sampler, tex_coord).r);
+	colour = vec4(text_colour.rgb, text_colour.a * texture(glyph_sampler, tex_coord).r);
 }
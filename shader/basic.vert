@@ -9,27 +9,25 @@ vec2 positions[6] = vec2[](
 	vec2(0.0, 1.0)
 );
 
-vec2 tex_coords[6] = vec2[](
-	vec2(0.0, 0.0),
-	vec2(1.0, 0.0),
-	vec2(0.0, 1.0),
-	vec2(1.0, 0.0),
-	vec2(1.0, 1.0),
-	vec2(0.0, 1.0)
-);
+// Per-instance glyph data, see struct vk_glyph_instance
+layout(location = 0) in vec4 glyph_rect;
+layout(location = 1) in vec4 glyph_uv;
+layout(location = 2) in vec4 glyph_colour;
 
-layout(location = 0) out vec2 tex_coord;
+// Orthographic projection from pixels to clip space, see struct vk_viewport_transform
+layout(push_constant) uniform Viewport {
+	vec2 scale;
+	vec2 offset;
+} viewport;
 
-layout(push_constant) uniform push_constant {
-	float x;
-	float y;
-	float width;
-	float height;
-} glyph_position;
+layout(location = 0) out vec2 tex_coord;
+layout(location = 1) out vec4 text_colour;
 
 void main() {
-	tex_coord = tex_coords[gl_VertexIndex];
-	float x = positions[gl_VertexIndex].x * glyph_position.width + glyph_position.x;
-	float y = (positions[gl_VertexIndex].y * glyph_position.height) - (glyph_position.y + glyph_position.height);
-	gl_Position = vec4(2.0 * vec2(x / 1366.0, y / 768.0) - 1.0, 0.0, 1.0);
+	vec2 position = positions[gl_VertexIndex];
+	tex_coord = glyph_uv.xy + position * glyph_uv.zw;
+	text_colour = glyph_colour;
+	float x = position.x * glyph_rect.z + glyph_rect.x;
+	float y = (position.y * glyph_rect.w) - (glyph_rect.y + glyph_rect.w);
+	gl_Position = vec4(vec2(x, y) * viewport.scale + viewport.offset, 0.0, 1.0);
 }
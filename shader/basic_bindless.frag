@@ -0,0 +1,18 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+layout(location = 0) out vec4 colour;
+layout(location = 0) in vec2 tex_coord;
+layout(location = 1) in vec4 text_colour;
+
+// Every texture shares one set, see struct vk_bindless
+layout(binding = 0) uniform sampler glyph_sampler;
+layout(binding = 1) uniform texture2D textures[];
+
+// Follows the vertex stage's viewport transform, see VK_BINDLESS_TEXTURE_OFFSET
+layout(push_constant) uniform Texture {
+	layout(offset = 16) uint index;
+} texture_select;
+
+void main() {
+	colour = vec4(text_colour.rgb, text_colour.a * texture(sampler2D(textures[texture_select.index], glyph_sampler), tex_coord).r);
+}
\ No newline at end of file
@@ -6,6 +6,7 @@
 struct glyphs;
 struct font;
 struct session;
+struct vk_frame;
 typedef struct vk Vulkan;
 
 typedef struct ft {
@@ -16,6 +17,15 @@ typedef struct ft {
 Font ft_load(char* path, float size);
 void ft_unload(Font, Vulkan*);
 void ft_raster(Font*, Vulkan*, float size);
+/// Glyph bitmaps from ft_rasterize, waiting to be packed into the atlas
+struct ft_rasterized;
+/// The CPU half of ft_raster. Needs no Vulkan, so it can run on another thread before the device exists.
+struct ft_rasterized* ft_rasterize(Font*, float size);
+/// The GPU half of ft_raster, consuming the rasterized glyphs
+void ft_upload(Font*, Vulkan*, struct ft_rasterized*);
+/// Repacks the glyph atlas from scratch, rasterizing every previously rasterized glyph again
+void ft_repack(Font*, Vulkan*);
 
 size_t ft_glyph_count(Font*);
-void ft_draw_string(Vulkan* vk, const char* string, size_t string_len, float size, uint32_t image_index);
\ No newline at end of file
+/// Draws a string into the frame with one draw call per atlas page. The colour is packed as 0xRRGGBBAA.
+void ft_draw_string(Vulkan* vk, struct vk_frame* frame, const char* string, size_t string_len, float size, uint32_t colour);
\ No newline at end of file
@@ -1,5 +1,5 @@
 use ash::vk;
-use fontdue::{Font, FontSettings, layout::{GlyphRasterConfig, Layout, LayoutSettings, TextStyle, WrapStyle}};
+use fontdue::{Font, FontSettings, Metrics, layout::{GlyphRasterConfig, Layout, LayoutSettings, TextStyle, WrapStyle}};
 
 use std::{fs::File,io::Read};
 use std::collections::HashMap;
@@ -29,38 +29,51 @@ impl DerefMut for Vulkan {
 #[repr(C)]
 struct StagingBuffer {
     buffer: vk::Buffer,
-    memory: vk::DeviceMemory,
-    memory_requirements: vk::MemoryRequirements,
+    offset: vk::DeviceSize,
     buffer_len: u32
 }
 
+/// The location of a glyph in the atlas owned by `Vulkan`
 #[repr(C)]
 struct Glyph {
-    image: vk::Image,
-    view: vk::ImageView,
-    sampler: vk::Sampler,
-    memory: vk::DeviceMemory,
-    memory_requirements: vk::MemoryRequirements,
-    descriptor: vk::DescriptorSet
+    page: u32,
+    u: f32,
+    v: f32,
+    uv_width: f32,
+    uv_height: f32
 }
 
+/// Per-glyph vertex input, mirrors `struct vk_glyph_instance`
 #[repr(C)]
-struct GlyphPushConstant {
+#[derive(Clone, Copy)]
+struct GlyphInstance {
     x: f32,
     y: f32,
     width: f32,
-    height: f32
+    height: f32,
+    u: f32,
+    v: f32,
+    uv_width: f32,
+    uv_height: f32,
+    colour: [f32; 4]
+}
+
+/// `struct vk_frame`, only ever passed back to C
+#[repr(C)]
+struct Frame {
+    _opaque: [u8; 0]
 }
 
 extern "C" {
     fn vk_staging_buffer_create(vk: *mut Vulkan, data: *const u8, data_len: usize) -> StagingBuffer;
-    fn vk_staging_buffer_destroy(vk: *mut Vulkan, staging: *mut StagingBuffer);
+    fn vk_staging_buffer_fits(vk: *mut Vulkan, data_len: usize) -> bool;
     fn vk_staging_buffer_start_transfer(vk: *mut Vulkan) -> vk::CommandBuffer;
     fn vk_staging_buffer_end_transfer(vk: *mut Vulkan, transfer_buffer: vk::CommandBuffer);
 
-    fn vk_create_glyph(vk: *mut Vulkan, staging: *mut StagingBuffer, transfer_buffer: vk::CommandBuffer, width: u32, height: u32) -> Glyph;
-    fn vk_destroy_glyph(vk: *mut Vulkan, glyph: *mut Glyph);
-    fn vk_draw_glyph(vk: *mut Vulkan, glyph: *mut Glyph, layout: GlyphPushConstant, image_index: u32);
+    fn vk_glyph_atlas_insert(vk: *mut Vulkan, staging: *mut StagingBuffer, transfer_buffer: vk::CommandBuffer, width: u32, height: u32) -> Glyph;
+    fn vk_glyph_atlas_reset(vk: *mut Vulkan);
+    fn vk_draw_glyphs(vk: *mut Vulkan, frame: *mut Frame, page: u32, instances: *const GlyphInstance, instance_len: u32);
+    fn vk_frame_extent(frame: *mut Frame) -> vk::Extent2D;
 }
 
 #[repr(C)]
@@ -96,49 +109,90 @@ extern "C" fn ft_load(path: *const i8, size: f32) -> Ft {
 }
 
 #[no_mangle]
-extern "C" fn ft_unload(mut ft: Ft, vk: *mut Vulkan) {
-    for (_, glyph) in ft.glyphs.iter_mut() {
-        unsafe { vk_destroy_glyph(vk, glyph) }
-    }
+extern "C" fn ft_unload(ft: Ft, _vk: *mut Vulkan) {
+    // Glyph textures live in the atlas, which vk_cleanup frees
+    drop(ft)
 }
 
-#[no_mangle]
-extern "C" fn ft_raster(ft: &mut Ft, vk: *mut Vulkan, size: f32) {
-    let mut staging_buffers = Vec::new();
-    for &character in FONT_CHARS {
+/// Glyph bitmaps rasterized before the atlas exists, opaque to C
+struct Rasterized(Vec<(char, f32, Metrics, Vec<u8>)>);
+
+fn rasterize_glyphs(ft: &Ft, glyphs: &[(char, f32)]) -> Rasterized {
+    Rasterized(glyphs.iter().map(|&(character, size)| {
         let (metrics, bitmap) = ft.font.rasterize(character, size);
-        staging_buffers.push((character, metrics, unsafe { vk_staging_buffer_create(vk, bitmap.as_ptr(), bitmap.len()) }));
-    }
-    let transfer_buffer = unsafe { vk_staging_buffer_start_transfer(vk) };
-    for (character, metrics, buffer) in staging_buffers.iter_mut() {
+        (character, size, metrics, bitmap)
+    }).collect())
+}
+
+/// Packs rasterized glyphs into the atlas, usually in a single transfer
+fn upload_glyphs(ft: &mut Ft, vk: *mut Vulkan, rasterized: Rasterized) {
+    let mut transfer_buffer = unsafe { vk_staging_buffer_start_transfer(vk) };
+    for (character, size, metrics, bitmap) in rasterized.0 {
         unsafe {
+            // The ring only reclaims regions of submitted transfers, so submit this one once it fills the ring
+            if !vk_staging_buffer_fits(vk, bitmap.len()) {
+                vk_staging_buffer_end_transfer(vk, transfer_buffer);
+                transfer_buffer = vk_staging_buffer_start_transfer(vk);
+            }
+            let mut staging = vk_staging_buffer_create(vk, bitmap.as_ptr(), bitmap.len());
             ft.glyphs.insert(
                 GlyphRasterConfig {
-                    c: *character,
+                    c: character,
                     px: size,
                     font_index: 0
                 },
-                vk_create_glyph(vk, buffer, transfer_buffer, metrics.width as _, metrics.height as _)
+                vk_glyph_atlas_insert(vk, &mut staging, transfer_buffer, metrics.width as _, metrics.height as _)
             );
         }
     }
+    // The upload ring reclaims the staging regions once the transfer completes
     unsafe { vk_staging_buffer_end_transfer(vk, transfer_buffer) }
-    for (_, _, buffer) in staging_buffers.iter_mut() {
-        unsafe {
-            vk_staging_buffer_destroy(vk, buffer);
-        }
-    }
-    staging_buffers.clear();
+}
+
+fn font_chars(size: f32) -> Vec<(char, f32)> {
+    FONT_CHARS.iter().map(|&character| (character, size)).collect()
 }
 
 #[no_mangle]
-extern "C" fn ft_draw_string(vk: &mut Vulkan, string: *const u8, string_len: usize, size: f32, image_index: u32) {
+extern "C" fn ft_raster(ft: &mut Ft, vk: *mut Vulkan, size: f32) {
+    let rasterized = rasterize_glyphs(ft, &font_chars(size));
+    upload_glyphs(ft, vk, rasterized);
+}
+
+/// Rasterizes without touching Vulkan, so it can run on any thread
+#[no_mangle]
+extern "C" fn ft_rasterize(ft: &Ft, size: f32) -> *mut Rasterized {
+    Box::into_raw(Box::new(rasterize_glyphs(ft, &font_chars(size))))
+}
+
+#[no_mangle]
+extern "C" fn ft_upload(ft: &mut Ft, vk: *mut Vulkan, rasterized: *mut Rasterized) {
+    let rasterized = unsafe { Box::from_raw(rasterized) };
+    upload_glyphs(ft, vk, *rasterized);
+}
+
+/// Empties the atlas and packs every glyph rasterized so far back into it
+#[no_mangle]
+extern "C" fn ft_repack(ft: &mut Ft, vk: *mut Vulkan) {
+    let glyphs: Vec<_> = ft.glyphs.keys().map(|config| (config.c, config.px)).collect();
+    ft.glyphs.clear();
+    unsafe { vk_glyph_atlas_reset(vk) }
+    let rasterized = rasterize_glyphs(ft, &glyphs);
+    upload_glyphs(ft, vk, rasterized);
+}
+
+/// Draws a string with one draw call per atlas page it touches, usually just one.
+/// The colour is packed as 0xRRGGBBAA.
+#[no_mangle]
+extern "C" fn ft_draw_string(vk: &mut Vulkan, frame: *mut Frame, string: *const u8, string_len: usize, size: f32, colour: u32) {
     let mut layout = Layout::new();
+    // Wrap at the edge of whatever mode the output is in
+    let extent = unsafe { vk_frame_extent(frame) };
     let settings = LayoutSettings {
         include_whitespace: false,
         wrap_style: WrapStyle::Letter,
-        max_width: Some(1920.0),
-        max_height: Some(1080.0),
+        max_width: Some(extent.width as f32),
+        max_height: Some(extent.height as f32),
         ..Default::default()
     };
     let mut output = Vec::new();
@@ -147,15 +201,42 @@ extern "C" fn ft_draw_string(vk: &mut Vulkan, string: *const u8, string_len: usi
         &TextStyle::new(std::str::from_utf8(unsafe { std::slice::from_raw_parts(string, string_len) }).unwrap(), size, 0)
     ];
     layout.layout_horizontal(fonts, text, &settings, &mut output);
-    for glyph in output {
-        unsafe {
-            vk_draw_glyph(vk, vk.glyphs.get_mut(&glyph.key).expect("Character has not been rasterized"), GlyphPushConstant {
+
+    let colour = [
+        (colour >> 24 & 0xff) as f32 / 255.0,
+        (colour >> 16 & 0xff) as f32 / 255.0,
+        (colour >> 8 & 0xff) as f32 / 255.0,
+        (colour & 0xff) as f32 / 255.0
+    ];
+    let mut instances: Vec<(u32, GlyphInstance)> = output.iter()
+        .filter(|glyph| glyph.width != 0 && glyph.height != 0)
+        .map(|glyph| {
+            let atlas_glyph = vk.glyphs.get(&glyph.key).expect("Character has not been rasterized");
+            (atlas_glyph.page, GlyphInstance {
                 x: glyph.x,
                 y: glyph.y,
                 width: glyph.width as _,
-                height: glyph.height as _
-            }, image_index);
+                height: glyph.height as _,
+                u: atlas_glyph.u,
+                v: atlas_glyph.v,
+                uv_width: atlas_glyph.uv_width,
+                uv_height: atlas_glyph.uv_height,
+                colour
+            })
+        })
+        .collect();
+    // Group by page so each page is bound and drawn once
+    instances.sort_by_key(|&(page, _)| page);
+
+    let mut start = 0;
+    while start < instances.len() {
+        let page = instances[start].0;
+        let end = start + instances[start..].iter().take_while(|&&(glyph_page, _)| glyph_page == page).count();
+        let page_instances: Vec<GlyphInstance> = instances[start..end].iter().map(|&(_, instance)| instance).collect();
+        unsafe {
+            vk_draw_glyphs(vk, frame, page, page_instances.as_ptr(), page_instances.len() as _);
         }
+        start = end;
     }
 }
 
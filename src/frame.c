@@ -0,0 +1,87 @@
+#include "frame.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "util.h"
+
+/// Waits for each vblank of the display and forwards it to the scheduler eventfd
+static void* frame_scheduler_vblank_main(void* args) {
+	FrameScheduler* scheduler = args;
+	Vulkan* vk = scheduler->vk;
+
+	VkDisplayEventInfoEXT vk_event_info = {
+		.sType = VK_STRUCTURE_TYPE_DISPLAY_EVENT_INFO_EXT,
+		.displayEvent = VK_DISPLAY_EVENT_TYPE_FIRST_PIXEL_OUT_EXT
+	};
+	while (atomic_load(&scheduler->running)) {
+		// Display events are one-shot, so a new fence is registered for every refresh
+		VkFence vblank;
+		if (vk->register_display_event(vk->device, scheduler->output->display, &vk_event_info, NULL, &vblank) == VK_SUCCESS) {
+			// A display that is turned off never signals, so keep ticking at the nominal rate
+			vkWaitForFences(vk->device, 1, &vblank, VK_TRUE, 2 * scheduler->refresh_ns);
+			vkDestroyFence(vk->device, vblank, NULL);
+		} else {
+			struct timespec delay = {
+				.tv_sec = scheduler->refresh_ns / 1000000000,
+				.tv_nsec = scheduler->refresh_ns % 1000000000
+			};
+			nanosleep(&delay, NULL);
+		}
+		eventfd_write(scheduler->fd, 1);
+	}
+	return NULL;
+}
+
+FrameScheduler* frame_scheduler_setup(Vulkan* vk, Output* output) {
+	FrameScheduler* scheduler = malloc(sizeof(FrameScheduler));
+	scheduler->vk = vk;
+	scheduler->output = output;
+	scheduler->vblank = vk->display_control && output->display != VK_NULL_HANDLE;
+	uint32_t refresh_rate = output->display_mode_params.refreshRate ? output->display_mode_params.refreshRate : FRAME_DEFAULT_REFRESH_RATE;
+	// The refresh rate is in millihertz
+	scheduler->refresh_ns = 1000000000000ull / refresh_rate;
+	atomic_init(&scheduler->running, true);
+
+	if (scheduler->vblank) {
+		if ((scheduler->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+			panic("Unable to create frame scheduler eventfd");
+		pthread_create(&scheduler->thread_id, NULL, frame_scheduler_vblank_main, scheduler);
+	} else {
+		if ((scheduler->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+			panic("Unable to create frame scheduler timerfd");
+		struct itimerspec period = {
+			.it_interval = {
+				.tv_sec = scheduler->refresh_ns / 1000000000,
+				.tv_nsec = scheduler->refresh_ns % 1000000000
+			}
+		};
+		period.it_value = period.it_interval;
+		if (timerfd_settime(scheduler->fd, 0, &period, NULL) < 0)
+			panic("Unable to start frame scheduler timer");
+		if (!vk->headless.enabled)
+			fprintf(stderr, "VK_EXT_display_control is unavailable, pacing frames with a timer\n");
+	}
+
+	return scheduler;
+}
+
+void frame_scheduler_cleanup(FrameScheduler* scheduler) {
+	atomic_store(&scheduler->running, false);
+	if (scheduler->vblank)
+		pthread_join(scheduler->thread_id, NULL);
+	close(scheduler->fd);
+	free(scheduler);
+}
+
+uint64_t frame_scheduler_consume(FrameScheduler* scheduler) {
+	// Both eventfd and timerfd report the elapsed count as a single 64-bit read
+	uint64_t refreshes = 0;
+	if (read(scheduler->fd, &refreshes, sizeof(refreshes)) != sizeof(refreshes))
+		return 0;
+	return refreshes;
+}
\ No newline at end of file
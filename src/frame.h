@@ -0,0 +1,30 @@
+#pragma once
+
+#include "vk.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// The refresh rate in millihertz assumed when the display does not report one
+#define FRAME_DEFAULT_REFRESH_RATE 60000
+
+/// Paces rendering to the display refresh
+typedef struct frame_scheduler {
+	Vulkan* vk;
+	Output* output;
+	/// Readable once per refresh. An eventfd fed by the vblank thread, or a timerfd as the fallback.
+	int fd;
+	/// True when driven by VK_EXT_display_control vblank events rather than a timer
+	bool vblank;
+	uint64_t refresh_ns;
+	atomic_bool running;
+	pthread_t thread_id;
+} FrameScheduler;
+
+/// Paces frames to the refresh of a single output
+FrameScheduler* frame_scheduler_setup(Vulkan*, Output*);
+void frame_scheduler_cleanup(FrameScheduler*);
+/// Consumes the pending refreshes, returning the number that elapsed since the last call
+uint64_t frame_scheduler_consume(FrameScheduler*);
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "util.h"
+
+/// Acquires, records and presents a frame unless the output already shows the session's current content
+static void output_renderer_draw(OutputRenderer* renderer, size_t active_index) {
+	SessionHandler* active = renderer->sessions[active_index];
+	Vulkan* vk = renderer->vk;
+	const struct session* session = active->session;
+	// An acquired image has to be presented, so sessions that never draw are never acquired for
+	if (!session->render)
+		return;
+
+	// A stale swapchain is only rebuilt when a frame begins, and its replacement starts out blank.
+	// Limited headless runs draw every refresh, so they measure steady state frames.
+	uint64_t serial = session->damage ? session->damage(active->data) : 0;
+	if (session->damage && renderer->presented == active && serial == renderer->presented_serial && !renderer->output->swapchain_stale && !vk->headless.frame_limit)
+		return;
+
+	// Waiting for the slot and the image happens outside the lease so other outputs keep presenting
+	struct vk_frame frame;
+	if (!vk_frame_begin(vk, renderer->output, &frame))
+		return;
+	// The session records its layer on its own thread, unless the last recording can be replayed
+	struct vk_frame layer_frame;
+	if (vk_layer_begin(vk, renderer->layers[active_index], &frame, serial, session->damage != NULL, &layer_frame)) {
+		session_wait(session_render(active, &layer_frame));
+		vk_layer_end(vk, &layer_frame);
+	}
+	vk_lease_acquire(vk);
+	bool complete = vk_frame_end(vk, &frame);
+	vk_lease_release(vk);
+
+	// A layer left out of the frame is recorded again on the next refresh
+	renderer->presented = complete ? active : NULL;
+	renderer->presented_serial = serial;
+	if (renderer->primary && !renderer->first_frame_reported) {
+		fprintf(stderr, "Startup: first frame presented after %.2fms\n", elapsed_ms(&vk->startup_time));
+		renderer->first_frame_reported = true;
+	}
+}
+
+/// Reports a finished headless run, writes its last frame if a capture was requested and wakes the main thread
+static void output_renderer_headless_finish(OutputRenderer* renderer) {
+	Vulkan* vk = renderer->vk;
+	uint64_t frames = renderer->headless_frames;
+	fprintf(stderr, "Headless: %" PRIu64 " frames drawn in %.3fms each on average\n", frames, renderer->headless_draw_ms / frames);
+
+	if (vk->headless.capture_path) {
+		VkExtent2D extent = renderer->output->swapchain_extent;
+		vk_lease_acquire(vk);
+		const uint8_t* pixels = vk_headless_readback(vk, renderer->output);
+		FILE* capture = fopen(vk->headless.capture_path, "wb");
+		if (!capture)
+			panic("Unable to open headless capture file");
+		fprintf(capture, "P6\n%u %u\n255\n", extent.width, extent.height);
+		// Readback rows are B8G8R8A8, PPM wants R8G8B8
+		for (size_t pixel = 0; pixel < (size_t)extent.width * extent.height; pixel++) {
+			const uint8_t* bgra = &pixels[pixel * 4];
+			uint8_t rgb[3] = { bgra[2], bgra[1], bgra[0] };
+			fwrite(rgb, 1, sizeof(rgb), capture);
+		}
+		fclose(capture);
+		vk_lease_release(vk);
+	}
+	eventfd_write(renderer->finished_fd, 1);
+}
+
+static void* output_renderer_main(void* args) {
+	OutputRenderer* renderer = args;
+	SessionHandler** sessions = renderer->sessions;
+	// Sleeps until the next refresh, however long a display goes without one, or until stopped
+	struct pollfd polls[] = {
+		{ .fd = renderer->scheduler->fd, .events = POLLIN },
+		{ .fd = renderer->stop_fd, .events = POLLIN }
+	};
+
+	while (true) {
+		if (poll(polls, 2, -1) <= 0)
+			continue;
+		if (polls[1].revents & POLLIN)
+			break;
+		if (!frame_scheduler_consume(renderer->scheduler))
+			continue;
+		// Mode changes happen between frames, so sessions never see a swapchain disappear under them
+		if (vk_output_apply_mode(renderer->vk, renderer->output)) {
+			// Pace to the new refresh rate and redraw into the new swapchain
+			frame_scheduler_cleanup(renderer->scheduler);
+			renderer->scheduler = frame_scheduler_setup(renderer->vk, renderer->output);
+			polls[0].fd = renderer->scheduler->fd;
+			renderer->presented = NULL;
+
+			VkDisplayModeParametersKHR mode = renderer->output->display_mode_params;
+			struct session_event_mode event = {
+				.output = renderer->output - renderer->vk->outputs,
+				.width = mode.visibleRegion.width,
+				.height = mode.visibleRegion.height,
+				.refresh_rate = mode.refreshRate
+			};
+			for (size_t index = 0; index < renderer->sessions_len; index++)
+				if (sessions[index]->session->mode_changed)
+					session_execute(sessions[index], (fn_session_generic)sessions[index]->session->mode_changed, &event, sizeof(event));
+		}
+		size_t active_index = atomic_load(renderer->active_session);
+		SessionHandler* active = sessions[active_index];
+
+		// Run background updates for the other sessions in parallel with the frame.
+		// Sessions with an event fd are woken by it instead.
+		SessionToken updates[renderer->sessions_len];
+		size_t updates_len = 0;
+		if (renderer->primary) {
+			// The frame only reflects the update once it has run
+			if (active->session->update)
+				session_wait(session_execute(active, (fn_session_generic)active->session->update, NULL, 0));
+			for (size_t index = 0; index < renderer->sessions_len; index++)
+				if (index != active_index && sessions[index]->session->background_update && !sessions[index]->session->event_fd)
+					updates[updates_len++] = session_execute(sessions[index], (fn_session_generic)sessions[index]->session->background_update, NULL, 0);
+		}
+
+		uint64_t frame_limit = renderer->vk->headless.frame_limit;
+		if (!frame_limit) {
+			output_renderer_draw(renderer, active_index);
+		} else if (renderer->headless_frames < frame_limit) {
+			// Once the run is over nothing more is drawn until the compositor stops
+			struct timespec draw_start;
+			clock_gettime(CLOCK_MONOTONIC, &draw_start);
+			output_renderer_draw(renderer, active_index);
+			renderer->headless_draw_ms += elapsed_ms(&draw_start);
+			if (++renderer->headless_frames == frame_limit)
+				output_renderer_headless_finish(renderer);
+		}
+
+		// Join once per frame so no session falls more than a frame behind
+		for (size_t index = 0; index < updates_len; index++)
+			session_wait(updates[index]);
+	}
+	return NULL;
+}
+
+OutputRenderer* output_renderer_setup(Vulkan* vk, Output* output, SessionHandler** sessions, size_t sessions_len, atomic_uint_fast8_t* active_session, bool primary) {
+	OutputRenderer* renderer = malloc(sizeof(OutputRenderer));
+	renderer->vk = vk;
+	renderer->output = output;
+	renderer->scheduler = frame_scheduler_setup(vk, output);
+	renderer->sessions = sessions;
+	renderer->sessions_len = sessions_len;
+	renderer->layers = malloc(sizeof(Layer*) * sessions_len);
+	vk_lease_acquire(vk);
+	for (size_t index = 0; index < sessions_len; index++)
+		renderer->layers[index] = vk_layer_setup(vk, output);
+	vk_lease_release(vk);
+	renderer->active_session = active_session;
+	renderer->primary = primary;
+	renderer->presented = NULL;
+	renderer->presented_serial = 0;
+	renderer->first_frame_reported = false;
+	renderer->headless_frames = 0;
+	renderer->headless_draw_ms = 0;
+	renderer->finished_fd = -1;
+	if (vk->headless.frame_limit && (renderer->finished_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+		panic("Unable to create output renderer eventfd");
+	if ((renderer->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+		panic("Unable to create output renderer eventfd");
+	if (pthread_create(&renderer->thread_id, NULL, output_renderer_main, renderer) != 0)
+		panic("Unable to start output render thread");
+	return renderer;
+}
+
+void output_renderer_cleanup(OutputRenderer* renderer) {
+	eventfd_write(renderer->stop_fd, 1);
+	pthread_join(renderer->thread_id, NULL);
+	close(renderer->stop_fd);
+	if (renderer->finished_fd >= 0)
+		close(renderer->finished_fd);
+	frame_scheduler_cleanup(renderer->scheduler);
+	vk_lease_acquire(renderer->vk);
+	for (size_t index = 0; index < renderer->sessions_len; index++)
+		vk_layer_cleanup(renderer->vk, renderer->layers[index]);
+	vk_lease_release(renderer->vk);
+	free(renderer->layers);
+	free(renderer);
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "vk.h"
+#include "frame.h"
+#include "session/session.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// Presents the active session to one output from its own thread, so a slow display never holds back the others
+typedef struct output_renderer {
+	Vulkan* vk;
+	Output* output;
+	FrameScheduler* scheduler;
+
+	SessionHandler** sessions;
+	size_t sessions_len;
+	/// One per session, recorded on the session's thread
+	Layer** layers;
+	/// Index of the session shown on every output, changed by the main thread
+	atomic_uint_fast8_t* active_session;
+	/// The primary output also paces the per-refresh session updates
+	bool primary;
+
+	/// The session and damage serial of the last presented frame, only accessed from the render thread
+	SessionHandler* presented;
+	uint64_t presented_serial;
+	/// Whether time-to-first-frame has been reported, which only the primary output does
+	bool first_frame_reported;
+	/// Only used by headless runs with a frame limit: the frames drawn and CPU time spent drawing them so far, and an
+	/// eventfd signalled once the run has finished, or -1
+	uint64_t headless_frames;
+	double headless_draw_ms;
+	int finished_fd;
+
+	/// An eventfd the render thread waits on alongside its scheduler, signalled to stop it
+	int stop_fd;
+	pthread_t thread_id;
+} OutputRenderer;
+
+OutputRenderer* output_renderer_setup(Vulkan*, Output*, SessionHandler** sessions, size_t sessions_len, atomic_uint_fast8_t* active_session, bool primary);
+void output_renderer_cleanup(OutputRenderer*);
\ No newline at end of file
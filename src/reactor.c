@@ -0,0 +1,56 @@
+#include "reactor.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/// The maximum number of ready sources handled per dispatch
+#define REACTOR_EVENTS_LEN 16
+
+Reactor reactor_setup(void) {
+	Reactor reactor;
+	if ((reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		panic("Unable to create epoll instance");
+	return reactor;
+}
+
+void reactor_cleanup(Reactor* reactor) {
+	close(reactor->epoll_fd);
+}
+
+struct reactor_source* reactor_add(Reactor* reactor, int fd, uint32_t events, fn_reactor_callback callback, void* data) {
+	struct reactor_source* source = malloc(sizeof(struct reactor_source));
+	source->fd = fd;
+	source->callback = callback;
+	source->data = data;
+
+	struct epoll_event event = {
+		.events = events,
+		.data.ptr = source
+	};
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		panic("Unable to add fd to epoll instance");
+	return source;
+}
+
+void reactor_remove(Reactor* reactor, struct reactor_source* source) {
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	free(source);
+}
+
+void reactor_dispatch(Reactor* reactor, int timeout) {
+	struct epoll_event events[REACTOR_EVENTS_LEN];
+	int events_len = epoll_wait(reactor->epoll_fd, events, REACTOR_EVENTS_LEN, timeout);
+	if (events_len < 0) {
+		if (errno == EINTR)
+			return;
+		panic("Unable to wait on epoll instance");
+	}
+
+	for (int index = 0; index < events_len; index++) {
+		struct reactor_source* source = events[index].data.ptr;
+		source->callback(source->fd, events[index].events, source->data);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/// Called from reactor_dispatch when a watched fd has one of the requested events
+typedef void (*fn_reactor_callback)(int fd, uint32_t events, void* data);
+
+struct reactor_source {
+	int fd;
+	fn_reactor_callback callback;
+	void* data;
+};
+
+/// A single epoll instance multiplexing every fd the compositor waits on
+typedef struct reactor {
+	int epoll_fd;
+} Reactor;
+
+Reactor reactor_setup(void);
+void reactor_cleanup(Reactor*);
+
+/// Watches `fd` for `events` (EPOLLIN, EPOLLET, ...) until removed
+struct reactor_source* reactor_add(Reactor*, int fd, uint32_t events, fn_reactor_callback callback, void* data);
+void reactor_remove(Reactor*, struct reactor_source*);
+/// Blocks for up to `timeout` milliseconds, or indefinitely if negative, then runs the callbacks of every ready source
+void reactor_dispatch(Reactor*, int timeout);
\ No newline at end of file
@@ -1,27 +1,78 @@
 #include "session.h"
+#include "../util.h"
+
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/// Blocks until a command is available and returns it without removing it from the queue
+static struct session_command* session_queue_wait(SessionHandler* handler) {
+    size_t tail = atomic_load_explicit(&handler->queue_tail, memory_order_relaxed);
+    while (atomic_load_explicit(&handler->queue_head, memory_order_acquire) == tail) {
+        // Announce the wait before checking again so a concurrent push cannot be missed
+        atomic_store(&handler->wake_waiting, true);
+        if (atomic_load(&handler->queue_head) == tail) {
+            eventfd_t value;
+            eventfd_read(handler->wake_fd, &value);
+        }
+        atomic_store(&handler->wake_waiting, false);
+    }
+    return &handler->queue[tail % SESSION_QUEUE_LEN];
+}
+
+/// Removes the command returned by session_queue_wait, marking it complete and freeing its slot for producers
+static void session_queue_pop(SessionHandler* handler) {
+    atomic_fetch_add(&handler->queue_tail, 1);
+    // Wake every waiter so each can check its own sequence
+    unsigned int waiters = atomic_load(&handler->progress_waiters);
+    if (waiters)
+        eventfd_write(handler->progress_fd, waiters);
+}
+
+/// Blocks the calling thread until the queue tail has reached `sequence`
+static void session_queue_wait_tail(SessionHandler* handler, size_t sequence) {
+    // Unsigned difference so the comparison survives the indices wrapping
+    while ((ssize_t)(sequence - atomic_load_explicit(&handler->queue_tail, memory_order_acquire)) > 0) {
+        atomic_fetch_add(&handler->progress_waiters, 1);
+        // Wakeups left over from other waiters only cost an extra check
+        if ((ssize_t)(sequence - atomic_load(&handler->queue_tail)) > 0) {
+            eventfd_t value;
+            eventfd_read(handler->progress_fd, &value);
+        }
+        atomic_fetch_sub(&handler->progress_waiters, 1);
+    }
+}
+
+/// Runs session setup as the first command so that session_setup can wait on it
+static void session_run_setup(void* data, Vulkan* vk, void* args) {
+    SessionHandler* handler = *(SessionHandler**)args;
+    handler->session->setup(&handler->data, vk);
+}
+
+struct session_render_args {
+    SessionHandler* handler;
+    struct vk_frame* frame;
+};
+
+static void session_run_render(void* data, Vulkan* vk, void* args) {
+    struct session_render_args* render = args;
+    // Recording only touches the frame's own command buffer, so it needs no lease
+    render->handler->session->render(data, vk, render->frame);
+}
 
 void* session_thread_main(void* args) {
     SessionHandler* handler = (SessionHandler*)args;
-    handler->session->setup(&handler->data, handler->vk);
 
     while (true) {
-        // Await next command
-        pthread_barrier_wait(&handler->barrier);
-        // Allow the main thread to modify handler without a data race on the mutex
-        pthread_barrier_wait(&handler->barrier);
-
-        // TODO: mutex should not be needed with the barrier gate, assert this
-        pthread_mutex_lock(&handler->mutex);
-        
-        pthread_mutex_lock(&handler->vk->mutex);
-        handler->function(handler->data, handler->vk, handler->args);
-        pthread_mutex_unlock(&handler->vk->mutex);
-
-        if (handler->session == NULL) {
+        struct session_command* command = session_queue_wait(handler);
+        if (command->function == NULL)
             return NULL;
-        }
-        pthread_mutex_unlock(&handler->mutex);
+
+        // Sessions lease the GPU themselves with vk_lease_acquire only while they use it
+        command->function(handler->data, handler->vk, command->args_len ? command->args : NULL);
+
+        session_queue_pop(handler);
     }
 }
 
@@ -29,35 +80,75 @@ struct session_handler* session_setup(Vulkan* vk, const struct session* session)
     struct session_handler* handler = malloc(sizeof(struct session_handler));
     handler->vk = vk;
     handler->session = session;
-    pthread_barrier_init(&handler->barrier, NULL, 2);
-    pthread_mutex_init(&handler->mutex, NULL);
+    atomic_init(&handler->queue_head, 0);
+    atomic_init(&handler->queue_tail, 0);
+    atomic_init(&handler->wake_waiting, false);
+    atomic_init(&handler->progress_waiters, 0);
+    pthread_mutex_init(&handler->queue_mutex, NULL);
+    if ((handler->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0 || (handler->progress_fd = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE)) < 0)
+        panic("Unable to create session eventfd");
     pthread_create(&handler->thread_id, NULL, session_thread_main, handler);
 
+    // handler->data is only valid once setup has run
+    session_wait(session_execute(handler, session_run_setup, &handler, sizeof(handler)));
     return handler;
 }
 
 void session_cleanup(SessionHandler* handler) {
-    pthread_barrier_wait(&handler->barrier);
-    pthread_mutex_lock(&handler->mutex);
-    handler->function = (fn_session_generic)handler->session->cleanup;
-
-    // When behind the mutex and/or only one barrier, which should be more than enough,
-    // this change is not observed in the waiting thread...
-    handler->session = NULL;
-    pthread_mutex_unlock(&handler->mutex);
-    pthread_barrier_wait(&handler->barrier);
+    session_execute(handler, (fn_session_generic)handler->session->cleanup, NULL, 0);
+    // A NULL function stops the thread once every queued command has run
+    session_execute(handler, NULL, NULL, 0);
 
     pthread_join(handler->thread_id, NULL);
-    pthread_barrier_destroy(&handler->barrier);
+    close(handler->wake_fd);
+    close(handler->progress_fd);
+    pthread_mutex_destroy(&handler->queue_mutex);
     free(handler);
 }
 
-void session_execute(SessionHandler* handler, fn_session_generic function, void* args) {
-    pthread_barrier_wait(&handler->barrier);
-    pthread_mutex_lock(&handler->mutex);
-    handler->function = function;
-    handler->args = args;
-    pthread_mutex_unlock(&handler->mutex);
+SessionToken session_execute(SessionHandler* handler, fn_session_generic function, const void* args, size_t args_len) {
+    if (args_len > SESSION_COMMAND_ARGS_LEN)
+        panic("Session command arguments are too large");
+
+    pthread_mutex_lock(&handler->queue_mutex);
+    size_t head = atomic_load_explicit(&handler->queue_head, memory_order_relaxed);
+    // Only block when the session thread has fallen a full queue behind
+    session_queue_wait_tail(handler, head + 1 - SESSION_QUEUE_LEN);
+
+    struct session_command* command = &handler->queue[head % SESSION_QUEUE_LEN];
+    command->function = function;
+    command->args_len = args_len;
+    if (args_len)
+        memcpy(command->args, args, args_len);
+
+    atomic_store(&handler->queue_head, head + 1);
+    pthread_mutex_unlock(&handler->queue_mutex);
+    if (atomic_load(&handler->wake_waiting))
+        eventfd_write(handler->wake_fd, 1);
+
+    return (SessionToken){ .handler = handler, .sequence = head + 1 };
+}
+
+SessionToken session_render(SessionHandler* handler, struct vk_frame* frame) {
+    // Nothing to draw, so the frame is complete once the commands before it are
+    if (!handler->session->render)
+        return (SessionToken){ .handler = handler, .sequence = atomic_load(&handler->queue_head) };
+    struct session_render_args args = { .handler = handler, .frame = frame };
+    return session_execute(handler, session_run_render, &args, sizeof(args));
+}
+
+void session_show(SessionHandler* handler) {
+    session_execute(handler, (fn_session_generic)handler->session->shown, NULL, 0);
+}
+
+void session_hide(SessionHandler* handler) {
+    session_execute(handler, (fn_session_generic)handler->session->hidden, NULL, 0);
+}
+
+bool session_poll(SessionToken token) {
+    return (ssize_t)(token.sequence - atomic_load_explicit(&token.handler->queue_tail, memory_order_acquire)) <= 0;
+}
 
-    pthread_barrier_wait(&handler->barrier);
+void session_wait(SessionToken token) {
+    session_queue_wait_tail(token.handler, token.sequence);
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 
 #include "../vk.h"
 #include "../font.h"
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 
 struct session_event_key {
@@ -10,6 +12,16 @@ struct session_event_key {
     uint8_t modifiers;
 };
 
+/// An output's new mode, sent after a runtime mode change has been applied
+struct session_event_mode {
+    /// Index into the outputs of Vulkan
+    uint32_t output;
+    uint32_t width;
+    uint32_t height;
+    /// In millihertz
+    uint32_t refresh_rate;
+};
+
 typedef void (*fn_session_setup)(void** data, Vulkan*);
 typedef void (*fn_session_cleanup)(void* data, Vulkan*);
 typedef void (*fn_session_shown)(void* data, Vulkan*);
@@ -18,7 +30,16 @@ typedef void (*fn_session_hidden)(void* data, Vulkan*);
 typedef void (*fn_session_update)(void* data, Vulkan*);
 typedef void (*fn_session_background_update)(void* data);
 typedef void (*fn_session_key_event)(void* data, Vulkan*, struct session_event_key*);
+typedef void (*fn_session_mode_changed)(void* data, Vulkan*, struct session_event_mode*);
 typedef void (*fn_session_generic)(void* data, Vulkan*, void* args);
+/// Returns an fd that becomes readable when background_update has work to do
+typedef int (*fn_session_event_fd)(void* data);
+/// Returns a serial that changes whenever the session needs to be redrawn.
+/// Called from output render threads, so it must be safe to call while the session thread runs.
+typedef uint64_t (*fn_session_damage)(void* data);
+/// Records the session's layer from within the output's render pass, into a secondary command buffer that
+/// is replayed for as long as the damage serial stays the same. The output render thread submits and presents it.
+typedef void (*fn_session_render)(void* data, Vulkan*, struct vk_frame*);
 
 struct session {
     fn_session_setup setup;
@@ -28,19 +49,60 @@ struct session {
     fn_session_update update;
     fn_session_background_update background_update;
     fn_session_key_event key_event;
+    /// Optional. Queued by the output's render thread whenever it switches the output to another mode.
+    fn_session_mode_changed mode_changed;
+    /// Optional. When set, background_update runs whenever the fd is readable instead of once per refresh.
+    fn_session_event_fd event_fd;
+    /// Optional. Without it the session is redrawn every refresh.
+    fn_session_damage damage;
+    /// Optional. Sessions without it never draw.
+    fn_session_render render;
+};
+
+/// The maximum number of commands that may be queued for a session before session_execute blocks
+#define SESSION_QUEUE_LEN 32
+/// The maximum size of the arguments copied into a command
+#define SESSION_COMMAND_ARGS_LEN 16
+
+struct session_command {
+    /// The session function to call within the session thread, or NULL to stop the thread
+    fn_session_generic function;
+    size_t args_len;
+    /// Arguments are copied in so the caller does not have to keep them alive until the command runs
+    _Alignas(max_align_t) uint8_t args[SESSION_COMMAND_ARGS_LEN];
 };
+
 typedef struct session_handler {
     pthread_t thread_id;
-    pthread_barrier_t barrier;
-    pthread_mutex_t mutex;
     Vulkan* vk;
     void* data;
     const struct session* session;
-    /// The session function to call within the session thread
-    fn_session_generic function;
-    void* args;
+
+    /// Ring of commands consumed by the session thread.
+    /// The main thread and output render threads push commands, serialized by queue_mutex.
+    struct session_command queue[SESSION_QUEUE_LEN];
+    pthread_mutex_t queue_mutex;
+    /// Index of the next command to be written, only advanced while holding queue_mutex
+    atomic_size_t queue_head;
+    /// Index of the next command to be run, only advanced by the session thread
+    atomic_size_t queue_tail;
+
+    /// Signalled when a command is pushed while the session thread is waiting
+    int wake_fd;
+    atomic_bool wake_waiting;
+    /// A semaphore eventfd, signalled once for every thread waiting for space or a token when a command completes
+    int progress_fd;
+    atomic_uint progress_waiters;
 } SessionHandler;
 
+/// Identifies a queued command so the thread that queued it can check for or wait on its completion
+typedef struct session_token {
+    SessionHandler* handler;
+    /// The command is complete once the queue tail has passed this value
+    size_t sequence;
+} SessionToken;
+
+/// Starts the session thread and waits for the session to finish its setup
 struct session_handler* session_setup(Vulkan* vk, const struct session*);
 void session_cleanup(SessionHandler* handler);
 
@@ -51,4 +113,15 @@ enum session_function {
     SESSION_FUNCTION_BACKGROUND_UPDATE= 5,
     SESSION_FUNCTION_KEY_EVENT = 6
 };
-void session_execute(SessionHandler* handler, fn_session_generic function, void* args);
\ No newline at end of file
+/// Queues a function to be run in the session thread without waiting for it to complete.
+/// `args_len` bytes are copied from `args`, which may be NULL if `args_len` is 0.
+SessionToken session_execute(SessionHandler* handler, fn_session_generic function, const void* args, size_t args_len);
+/// Queues recording the session into an acquired frame. The frame must stay alive until the token completes.
+SessionToken session_render(SessionHandler* handler, struct vk_frame* frame);
+/// Queue the shown and hidden callbacks
+void session_show(SessionHandler* handler);
+void session_hide(SessionHandler* handler);
+/// Returns true once the command identified by the token has completed
+bool session_poll(SessionToken token);
+/// Blocks until the command identified by the token has completed
+void session_wait(SessionToken token);
\ No newline at end of file
@@ -3,11 +3,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
 
 struct term_data {
 	float colr;
 	float colg;
 	float colb;
+	/// Read by output render threads through term_damage
+	atomic_uint_fast64_t serial;
 };
 
 static void term_setup(void** data, Vulkan* vk) {
@@ -16,6 +19,7 @@ static void term_setup(void** data, Vulkan* vk) {
 	term->colr = (float)(rand() % 1000) / 1000.0;
 	term->colg = (float)(rand() % 1000) / 1000.0;
 	term->colb = (float)(rand() % 1000) / 1000.0;
+	atomic_init(&term->serial, 0);
 }
 
 static void term_cleanup(void* data, Vulkan* vk) {
@@ -36,86 +40,39 @@ static void term_hidden(void* data, Vulkan* vk) {
 
 }
 
-static void term_update(void* data, Vulkan* vk) {
+/// Bumped whenever the terminal needs to be redrawn
+static uint64_t term_damage(void* data) {
 	struct term_data* term = data;
-	vk->current_inflight = (vk->current_inflight + 1) % VK_MAX_INFLIGHT;
-	InFlight* inflight = &vk->inflight[vk->current_inflight];
-
-	vkWaitForFences(vk->device, 1, &inflight->fence, VK_TRUE, UINT64_MAX);
-	vkResetFences(vk->device, 1, &inflight->fence);
-
-    uint32_t image_index;
-	VkResult vk_result = vkAcquireNextImageKHR(vk->device, vk->swapchain, UINT64_MAX, inflight->render_semaphore, VK_NULL_HANDLE, &image_index);
-	switch (vk_result) {
-		case VK_SUCCESS:
-			break;
-		case VK_TIMEOUT:
-		case VK_NOT_READY:
-			return;
-		case VK_SUBOPTIMAL_KHR:
-			TODO
-		default:
-			panic("Unexpected error when acquiring next swapchain image");
-	}
+	return atomic_load(&term->serial);
+}
 
-	VkCommandBufferBeginInfo vk_command_begin_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
-	};
-	if (vkBeginCommandBuffer(vk->command_buffers[image_index], &vk_command_begin_info) != VK_SUCCESS)
-		panic("Unable to start command buffer");
+static void term_render(void* data, Vulkan* vk, struct vk_frame* frame) {
+	struct term_data* term = data;
 
-	VkClearValue vk_clear_values[] = {
-		{ { { term->colr, term->colg, term->colb, 1.0f } } }
+	// Layers are recorded inside the output's render pass, so the background is cleared here
+	VkClearAttachment vk_clear_attachment = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.colorAttachment = 0,
+		.clearValue = { { { term->colr, term->colg, term->colb, 1.0f } } }
 	};
-	VkRenderPassBeginInfo vk_renderpass_begin_info = {
-		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-		.renderPass = vk->renderpass,
-		.framebuffer = vk->framebuffers[image_index],
-		.renderArea = {
+	VkClearRect vk_clear_rect = {
+		.rect = {
 			.offset = { 0, 0 },
-			.extent = vk->swapchain_extent
+			.extent = frame->extent
 		},
-		.clearValueCount = 1,
-		.pClearValues = vk_clear_values,
+		.baseArrayLayer = 0,
+		.layerCount = 1
 	};
-	vkCmdBeginRenderPass(vk->command_buffers[image_index], &vk_renderpass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(vk->command_buffers[image_index], VK_PIPELINE_BIND_POINT_GRAPHICS, vk->glyph_pipeline.pipeline);
+	vkCmdClearAttachments(frame->command_buffer, 1, &vk_clear_attachment, 1, &vk_clear_rect);
+	vkCmdBindPipeline(frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk->glyph_pipeline.pipeline);
 
 	#define strln(string) string, sizeof(string)-1
-	ft_draw_string(vk, strln("Hello, World!"), 12.0f, image_index);
-
-	vkCmdEndRenderPass(vk->command_buffers[image_index]);
-	if (vkEndCommandBuffer(vk->command_buffers[image_index]) != VK_SUCCESS)
-		panic("Unable to complete command buffer");
-
-	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	VkSubmitInfo vk_submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &inflight->render_semaphore,
-		.pWaitDstStageMask = wait_stages,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &vk->command_buffers[image_index],
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = &inflight->present_semaphore
-	};
-	if (vkQueueSubmit(vk->queue, 1, &vk_submit_info, inflight->fence) != VK_SUCCESS)
-		panic("Unable to submit render queue");
-
-	VkPresentInfoKHR vk_present_info = {
-		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &inflight->present_semaphore,
-		.swapchainCount = 1,
-		.pSwapchains = &vk->swapchain,
-		.pImageIndices = &image_index
-	};
-	if (vkQueuePresentKHR(vk->queue, &vk_present_info) != VK_SUCCESS)
-		panic("Unable to present the swapchain");
+	ft_draw_string(vk, frame, strln("Hello, World!"), 12.0f, 0xffffffff);
 }
 
 static void key_event(void* data, Vulkan* vk, struct session_event_key* event) {
-
+	struct term_data* term = data;
+	atomic_fetch_add(&term->serial, 1);
 }
 
 const struct session term_session = {
@@ -123,6 +80,7 @@ const struct session term_session = {
     .cleanup = term_cleanup,
     .shown = term_shown,
     .hidden = term_hidden,
-    .update = term_update,
-	.key_event = key_event
+	.key_event = key_event,
+	.damage = term_damage,
+	.render = term_render
 };
\ No newline at end of file
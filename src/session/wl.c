@@ -121,7 +121,7 @@ static void register_compositor(struct wl_client* client, void* data, uint32_t v
 }
 
 static void destroy_output(struct wl_resource* resource) {
-
+	wl_list_remove(wl_resource_get_link(resource));
 }
 static void output_release(struct wl_client* client, struct wl_resource* resource) {
 	wl_resource_destroy(resource);
@@ -129,14 +129,28 @@ static void output_release(struct wl_client* client, struct wl_resource* resourc
 static const struct wl_output_interface implement_output = {
 	.release = output_release
 };
+static void output_send_mode(struct wl_resource* resource, VkDisplayModeParametersKHR mode) {
+	// Both use millihertz
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT, mode.visibleRegion.width, mode.visibleRegion.height, mode.refreshRate);
+}
+static void output_send_done(struct wl_resource* resource) {
+	if (wl_resource_get_version(resource) >= WL_OUTPUT_DONE_SINCE_VERSION)
+		wl_output_send_done(resource);
+}
 static void register_output(struct wl_client* client, void* data, uint32_t version, uint32_t id) {
+	struct wl_output_global* global = data;
+	Output* output = global->output;
 	struct wl_resource* resource = wl_resource_create(client, &wl_output_interface, wl_output_interface.version, id);
 	wl_resource_set_implementation(resource, &implement_output, NULL, destroy_output);
+	wl_list_insert(&global->resources, wl_resource_get_link(resource));
 
-	//TODO
-	wl_output_send_geometry(resource, 0, 0, 300, 170, WL_OUTPUT_SUBPIXEL_UNKNOWN, "Unknown", "0x07B5", WL_OUTPUT_TRANSFORM_NORMAL);
-	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT, 1366, 768, 59994);
+	// Headless outputs have no display, so their physical size is unknown
+	const char* model = output->display_properties.displayName ? output->display_properties.displayName : "Unknown";
+	VkExtent2D physical_size = output->display_properties.physicalDimensions;
+	wl_output_send_geometry(resource, 0, 0, physical_size.width, physical_size.height, WL_OUTPUT_SUBPIXEL_UNKNOWN, "Unknown", model, WL_OUTPUT_TRANSFORM_NORMAL);
+	output_send_mode(resource, global->mode);
 	wl_output_send_scale(resource, 1);
+	output_send_done(resource);
 }
 
 static void destroy_keyboard(struct wl_resource* resource) {}
@@ -218,7 +232,16 @@ static void wl_session_setup(void** data, Vulkan* vk) {
 	wl_display_add_socket_auto(wl->display);
 
 	wl->global_compositor = wl_global_create(wl->display, &wl_compositor_interface, wl_compositor_interface.version, NULL, register_compositor);
-	wl->global_output = wl_global_create(wl->display, &wl_output_interface, wl_output_interface.version, NULL, register_output);
+	wl->global_output_len = vk->output_len;
+	wl->global_outputs = malloc(sizeof(struct wl_output_global) * wl->global_output_len);
+	for (uint32_t index = 0; index < wl->global_output_len; index++) {
+		struct wl_output_global* global = &wl->global_outputs[index];
+		// Sessions are set up before the render threads start, so the mode is not changing yet
+		global->output = &vk->outputs[index];
+		global->mode = global->output->display_mode_params;
+		wl_list_init(&global->resources);
+		global->global = wl_global_create(wl->display, &wl_output_interface, wl_output_interface.version, global, register_output);
+	}
 	wl->global_seat = wl_global_create(wl->display, &wl_seat_interface, wl_seat_interface.version, NULL, register_seat);
 	wl->global_data_device_manager = wl_global_create(wl->display, &wl_data_device_manager_interface, wl_data_device_manager_interface.version, NULL, register_data_device_manager);
 	wl->global_xdg_wm_base = wl_global_create(wl->display, &xdg_wm_base_interface, xdg_wm_base_interface.version, NULL, register_xdg_wm_base);
@@ -234,18 +257,19 @@ static void wl_session_setup(void** data, Vulkan* vk) {
 static void wl_session_cleanup(void* data, Vulkan* vk) {
 	Wayland* wl = data;
 	wl_global_destroy(wl->global_compositor);
-	wl_global_destroy(wl->global_output);
+	for (uint32_t index = 0; index < wl->global_output_len; index++)
+		wl_global_destroy(wl->global_outputs[index].global);
 	wl_global_destroy(wl->global_seat);
 	wl_global_destroy(wl->global_data_device_manager);
 	wl_global_destroy(wl->global_xdg_wm_base);
 
 	wl_display_destroy(wl->display);
+	// Destroying the display destroys the remaining wl_output resources, which unlink themselves from these
+	free(wl->global_outputs);
 
 	free(data);
 }
 
-/// The time in milliseconds to block during the wayland event loop to reduce resource usage as this thread has little work to do
-#define WL_UPDATE_BLOCK_DELAY 1
 static void wl_session_shown(void* data, Vulkan* vk) {
 
 }
@@ -254,19 +278,37 @@ static void wl_session_hidden(void* data, Vulkan* vk) {
 }
 static void wl_session_update(void* data, Vulkan* vk) {
 	struct wl* wl = data;
-	if (wl_event_loop_dispatch(wl->event_loop, 1))
+	if (wl_event_loop_dispatch(wl->event_loop, 0))
 		/* error */;
 	wl_display_flush_clients(wl->display);
 }
+/// Runs whenever the event loop fd is readable, so it never needs to block
 static void wl_session_background_update(void* data) {
 	struct wl* wl = data;
-	if (wl_event_loop_dispatch(wl->event_loop, 1))
+	if (wl_event_loop_dispatch(wl->event_loop, 0))
 		/* error */;
 	wl_display_flush_clients(wl->display);
 }
+static int wl_session_event_fd(void* data) {
+	struct wl* wl = data;
+	return wl_event_loop_get_fd(wl->event_loop);
+}
 static void wl_session_key_event(void* data, Vulkan* vk, struct session_event_key* event) {
 
 }
+static void wl_session_mode_changed(void* data, Vulkan* vk, struct session_event_mode* event) {
+	struct wl* wl = data;
+	struct wl_output_global* global = &wl->global_outputs[event->output];
+	global->mode.visibleRegion.width = event->width;
+	global->mode.visibleRegion.height = event->height;
+	global->mode.refreshRate = event->refresh_rate;
+	struct wl_resource* resource;
+	wl_resource_for_each(resource, &global->resources) {
+		output_send_mode(resource, global->mode);
+		output_send_done(resource);
+	}
+	wl_display_flush_clients(wl->display);
+}
 
 const struct session wl_session = {
     .setup = wl_session_setup,
@@ -275,5 +317,7 @@ const struct session wl_session = {
     .hidden = wl_session_hidden,
     .update = wl_session_update,
 	.background_update = wl_session_background_update,
-	.key_event = wl_session_key_event
+	.key_event = wl_session_key_event,
+	.mode_changed = wl_session_mode_changed,
+	.event_fd = wl_session_event_fd
 };
\ No newline at end of file
@@ -4,12 +4,24 @@
 
 #include "session.h"
 
+/// An output advertised to clients
+struct wl_output_global {
+	struct wl_global* global;
+	Output* output;
+	/// The mode sent to clients. Only read from the output at setup, later modes arrive through mode_changed.
+	VkDisplayModeParametersKHR mode;
+	/// Every bound wl_output, so mode changes reach clients that are already connected
+	struct wl_list resources;
+};
+
 typedef struct wl {
 	struct wl_display* display;
 	struct wl_event_loop* event_loop;
 
 	struct wl_global* global_compositor;
-	struct wl_global* global_output;
+	/// One per output, advertising its current mode
+	struct wl_output_global* global_outputs;
+	uint32_t global_output_len;
 	struct wl_global* global_shm;
 	struct wl_global* global_seat;
 	struct wl_global* global_data_device_manager;
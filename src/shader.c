@@ -0,0 +1,30 @@
+#include "shader.h"
+
+#include <string.h>
+
+// Generated by build.sh with `glslc -mfmt=c`, which emits each module as an initializer list
+static const uint32_t basic_vert[] =
+#include "../shader/basic.vert.inc"
+;
+static const uint32_t basic_frag[] =
+#include "../shader/basic.frag.inc"
+;
+static const uint32_t basic_bindless_frag[] =
+#include "../shader/basic_bindless.frag.inc"
+;
+
+#define SHADER(variable, file) { .name = file, .code = variable, .code_len = sizeof(variable) }
+
+/// Add new shaders here after their source in shader/
+static const struct shader shaders[] = {
+	SHADER(basic_vert, "basic.vert"),
+	SHADER(basic_frag, "basic.frag"),
+	SHADER(basic_bindless_frag, "basic_bindless.frag"),
+};
+
+const struct shader* shader_find(const char* name) {
+	for (size_t index = 0; index < sizeof(shaders) / sizeof(*shaders); index++)
+		if (strcmp(shaders[index].name, name) == 0)
+			return &shaders[index];
+	return NULL;
+}
\ No newline at end of file
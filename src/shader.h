@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// SPIR-V compiled from shader/ by build.sh and linked into the binary
+struct shader {
+	/// The source file name, such as "basic.vert"
+	const char* name;
+	const uint32_t* code;
+	/// In bytes, as VkShaderModuleCreateInfo expects
+	size_t code_len;
+};
+
+/// Returns the embedded shader with the given name, or NULL if there is none
+const struct shader* shader_find(const char* name);
\ No newline at end of file
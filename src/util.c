@@ -6,4 +6,10 @@
 noreturn void panic(char* message) {
 	fprintf(stderr, "Panic: %s\n", message);
 	exit(1);
+}
+
+double elapsed_ms(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
 }
\ No newline at end of file
@@ -3,8 +3,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdnoreturn.h>
+#include <time.h>
 
 noreturn void panic(char* message);
+/// Milliseconds elapsed on the monotonic clock since start
+double elapsed_ms(const struct timespec* start);
 
 #define TODO panic("TODO - Unimplemented");
 
@@ -1,10 +1,15 @@
 #include "vk.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "util.h"
+#include "shader.h"
 
 const char* vk_instance_extensions[] = {
 	"VK_KHR_surface",
@@ -13,6 +18,19 @@ const char* vk_instance_extensions[] = {
 const char* vk_device_extensions[] = {
 	"VK_KHR_swapchain"
 };
+/// Enabled when available to drive the frame scheduler from vblank events
+const char* vk_instance_display_control_extension = "VK_EXT_display_surface_counter";
+const char* vk_device_display_control_extension = "VK_EXT_display_control";
+/// Enabled when available for bindless textures, see struct vk_bindless
+const char* vk_instance_properties2_extension = "VK_KHR_get_physical_device_properties2";
+/// Enabled when available for the transfer queue, see struct vk_transfer
+const char* vk_device_timeline_extension = "VK_KHR_timeline_semaphore";
+/// Enabled when available so uploads on the transfer queue can be timed, see struct vk_profiler
+const char* vk_device_host_query_reset_extension = "VK_EXT_host_query_reset";
+const char* vk_device_bindless_extensions[] = {
+	"VK_KHR_maintenance3",
+	"VK_EXT_descriptor_indexing"
+};
 #ifdef DEBUG
 const char* vk_validation_layers[] = {
 	"VK_LAYER_KHRONOS_validation"
@@ -24,44 +42,1481 @@ bool physical_device_suitable(VkPhysicalDevice device) {
 	return true;
 }
 
-bool load_shader(const char* path, uint8_t** shader_data, size_t* shader_len) {
-	FILE* shader_file = fopen(path, "rb");
-	if (!shader_file)
+static bool vk_extension_supported(VkExtensionProperties* extensions, uint32_t extension_len, const char* name) {
+	for (uint32_t index = 0; index < extension_len; index++)
+		if (strcmp(extensions[index].extensionName, name) == 0)
+			return true;
+	return false;
+}
+
+static bool vk_instance_extension_supported(const char* name) {
+	uint32_t extension_len = 0;
+	vkEnumerateInstanceExtensionProperties(NULL, &extension_len, NULL);
+	VkExtensionProperties* extensions = malloc(sizeof(VkExtensionProperties) * extension_len);
+	vkEnumerateInstanceExtensionProperties(NULL, &extension_len, extensions);
+	bool supported = vk_extension_supported(extensions, extension_len, name);
+	free(extensions);
+	return supported;
+}
+
+static bool vk_device_extension_supported(VkPhysicalDevice device, const char* name) {
+	uint32_t extension_len = 0;
+	vkEnumerateDeviceExtensionProperties(device, NULL, &extension_len, NULL);
+	VkExtensionProperties* extensions = malloc(sizeof(VkExtensionProperties) * extension_len);
+	vkEnumerateDeviceExtensionProperties(device, NULL, &extension_len, extensions);
+	bool supported = vk_extension_supported(extensions, extension_len, name);
+	free(extensions);
+	return supported;
+}
+
+VkShaderModule vk_shader_module_create(Vulkan* vk, const char* name) {
+	const struct shader* shader = shader_find(name);
+	if (!shader)
+		panic("No embedded shader with that name");
+	VkShaderModuleCreateInfo vk_shader_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = shader->code_len,
+		.pCode = shader->code
+	};
+	VkShaderModule module;
+	if (vkCreateShaderModule(vk->device, &vk_shader_info, NULL, &module) != VK_SUCCESS)
+		panic("Unable to create shader module");
+	return module;
+}
+
+/// Builds $XDG_CACHE_HOME/wayvk/pipeline-<cache uuid>-<driver version>, falling back to ~/.cache.
+/// Drivers reject caches written by other devices or drivers, so each gets its own file.
+static char* vk_pipeline_cache_path(Vulkan* vk) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	char uuid[VK_UUID_SIZE * 2 + 1];
+	for (uint32_t index = 0; index < VK_UUID_SIZE; index++)
+		sprintf(&uuid[index * 2], "%02x", properties.pipelineCacheUUID[index]);
+
+	const char* base = getenv("XDG_CACHE_HOME");
+	const char* suffix = "";
+	if (!base || base[0] != '/') {
+		base = getenv("HOME");
+		suffix = "/.cache";
+		if (!base || base[0] != '/')
+			return NULL;
+	}
+	size_t path_len = snprintf(NULL, 0, "%s%s/wayvk/pipeline-%s-%08x", base, suffix, uuid, properties.driverVersion) + 1;
+	char* path = malloc(path_len);
+	snprintf(path, path_len, "%s%s/wayvk/pipeline-%s-%08x", base, suffix, uuid, properties.driverVersion);
+	return path;
+}
+
+/// Creates the pipeline cache, seeded from disk if a previous boot saved one
+static void vk_pipeline_cache_setup(Vulkan* vk) {
+	vk->pipeline_cache_path = vk_pipeline_cache_path(vk);
+	uint8_t* data = NULL;
+	size_t data_len = 0;
+	FILE* cache_file = vk->pipeline_cache_path ? fopen(vk->pipeline_cache_path, "rb") : NULL;
+	if (cache_file) {
+		fseek(cache_file, 0, SEEK_END);
+		long file_len = ftell(cache_file);
+		fseek(cache_file, 0, SEEK_SET);
+		if (file_len > 0) {
+			data = malloc(file_len);
+			data_len = fread(data, 1, file_len, cache_file) == (size_t)file_len ? file_len : 0;
+		}
+		fclose(cache_file);
+	}
+
+	VkPipelineCacheCreateInfo vk_pipeline_cache_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = data_len,
+		.pInitialData = data
+	};
+	// A truncated or corrupt file only costs the warm start
+	if (vkCreatePipelineCache(vk->device, &vk_pipeline_cache_info, NULL, &vk->pipeline_cache) != VK_SUCCESS) {
+		data_len = vk_pipeline_cache_info.initialDataSize = 0;
+		if (vkCreatePipelineCache(vk->device, &vk_pipeline_cache_info, NULL, &vk->pipeline_cache) != VK_SUCCESS)
+			panic("Unable to create pipeline cache");
+	}
+	vk->pipeline_cache_warm = data_len > 0;
+	free(data);
+}
+
+/// Writes the pipeline cache to disk, replacing the old file atomically so a crash never leaves half a cache
+static void vk_pipeline_cache_save(Vulkan* vk) {
+	if (!vk->pipeline_cache_path)
+		return;
+	size_t data_len = 0;
+	if (vkGetPipelineCacheData(vk->device, vk->pipeline_cache, &data_len, NULL) != VK_SUCCESS || data_len == 0)
+		return;
+	uint8_t* data = malloc(data_len);
+	if (vkGetPipelineCacheData(vk->device, vk->pipeline_cache, &data_len, data) != VK_SUCCESS) {
+		free(data);
+		return;
+	}
+
+	// Create each missing directory leading up to the file
+	size_t path_len = strlen(vk->pipeline_cache_path);
+	char temp_path[path_len + 5];
+	memcpy(temp_path, vk->pipeline_cache_path, path_len + 1);
+	for (char* separator = strchr(temp_path + 1, '/'); separator; separator = strchr(separator + 1, '/')) {
+		*separator = '\0';
+		mkdir(temp_path, 0700);
+		*separator = '/';
+	}
+
+	strcat(temp_path, ".tmp");
+	FILE* cache_file = fopen(temp_path, "wb");
+	bool written = cache_file && fwrite(data, 1, data_len, cache_file) == data_len;
+	if (cache_file && fclose(cache_file) != 0)
+		written = false;
+	if (!written || rename(temp_path, vk->pipeline_cache_path) != 0) {
+		fprintf(stderr, "Unable to save the pipeline cache to %s\n", vk->pipeline_cache_path);
+		remove(temp_path);
+	}
+	free(data);
+}
+
+uint32_t vk_find_memory_type(Vulkan* vk, uint32_t memory_type, VkMemoryPropertyFlags memory_properties) {
+	for (uint32_t index = 0; index < vk->physical_device_memory_properties.memoryTypeCount; index++)
+		if (memory_type & (1 << index) && (vk->physical_device_memory_properties.memoryTypes[index].propertyFlags & memory_properties) == memory_properties)
+			return index;
+	panic("Unable to find suitable memory type");
+}
+
+/// The relative order of a whole block
+#define VK_MEMORY_BLOCK_LEVELS (VK_MEMORY_BLOCK_ORDER - VK_MEMORY_MIN_ORDER)
+
+static struct vk_memory_block* vk_memory_block_create(Vulkan* vk, uint32_t memory_type, VkDeviceSize size, bool dedicated) {
+	struct vk_memory_block* block = malloc(sizeof(struct vk_memory_block));
+	block->size = size;
+	block->allocation_len = 0;
+
+	VkMemoryAllocateInfo vk_memory_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.memoryTypeIndex = memory_type,
+		.allocationSize = size
+	};
+	if (vkAllocateMemory(vk->device, &vk_memory_info, NULL, &block->memory) != VK_SUCCESS)
+		panic("Unable to allocate device memory");
+	block->mapped = NULL;
+	if (vk->physical_device_memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		if (vkMapMemory(vk->device, block->memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped) != VK_SUCCESS)
+			panic("Unable to map device memory");
+
+	block->longest = NULL;
+	if (!dedicated) {
+		block->longest = malloc((2 << VK_MEMORY_BLOCK_LEVELS) - 1);
+		for (uint32_t depth = 0; depth <= VK_MEMORY_BLOCK_LEVELS; depth++)
+			memset(block->longest + (1 << depth) - 1, VK_MEMORY_BLOCK_LEVELS - depth + 1, 1 << depth);
+	}
+	return block;
+}
+
+static void vk_memory_block_destroy(Vulkan* vk, struct vk_memory_block* block) {
+	if (block->mapped)
+		vkUnmapMemory(vk->device, block->memory);
+	vkFreeMemory(vk->device, block->memory, NULL);
+	free(block->longest);
+	free(block);
+}
+
+/// Recomputes the largest free buddy of each ancestor of a node at `order`
+static void vk_memory_block_update(struct vk_memory_block* block, uint32_t index, uint32_t order) {
+	while (index > 0) {
+		index = (index - 1) / 2;
+		order++;
+		uint8_t left = block->longest[2 * index + 1];
+		uint8_t right = block->longest[2 * index + 2];
+		// Two wholly free buddies merge into their parent
+		if (left == order && right == order)
+			block->longest[index] = order + 1;
+		else
+			block->longest[index] = left > right ? left : right;
+	}
+}
+
+static bool vk_memory_block_alloc(struct vk_memory_block* block, uint32_t order, VkDeviceSize* offset) {
+	if (block->longest[0] < order + 1)
 		return false;
-	
-	fseek(shader_file, 0, SEEK_END);
-	*shader_len = ftell(shader_file);
-	fseek(shader_file, 0, SEEK_SET);
-	if (*shader_len < 0)
+	uint32_t index = 0;
+	for (uint32_t node_order = VK_MEMORY_BLOCK_LEVELS; node_order > order; node_order--)
+		index = block->longest[2 * index + 1] >= order + 1 ? 2 * index + 1 : 2 * index + 2;
+	block->longest[index] = 0;
+	vk_memory_block_update(block, index, order);
+
+	*offset = (VkDeviceSize)(index + 1 - (1 << (VK_MEMORY_BLOCK_LEVELS - order))) << (order + VK_MEMORY_MIN_ORDER);
+	block->allocation_len++;
+	return true;
+}
+
+static void vk_memory_block_free(struct vk_memory_block* block, VkDeviceSize offset, uint32_t order) {
+	uint32_t index = (1 << (VK_MEMORY_BLOCK_LEVELS - order)) - 1 + (uint32_t)(offset >> (order + VK_MEMORY_MIN_ORDER));
+	block->longest[index] = order + 1;
+	vk_memory_block_update(block, index, order);
+	block->allocation_len--;
+}
+
+struct vk_allocation vk_memory_alloc(Vulkan* vk, VkMemoryRequirements memory_requirements, VkMemoryPropertyFlags memory_properties, bool linear) {
+	uint32_t memory_type = vk_find_memory_type(vk, memory_requirements.memoryTypeBits, memory_properties);
+	struct vk_allocation allocation = {
+		.offset = 0,
+		.order = 0
+	};
+
+	if (memory_requirements.size > VK_MEMORY_DEDICATED_SIZE) {
+		allocation.block = vk_memory_block_create(vk, memory_type, memory_requirements.size, true);
+		allocation.block->allocation_len = 1;
+	} else {
+		// Buddies are aligned to their own size
+		VkDeviceSize size = memory_requirements.size > memory_requirements.alignment ? memory_requirements.size : memory_requirements.alignment;
+		while (((VkDeviceSize)1 << (allocation.order + VK_MEMORY_MIN_ORDER)) < size)
+			allocation.order++;
+
+		struct vk_memory_pool* pool = &vk->allocator.pools[memory_type][linear ? 1 : 0];
+		allocation.block = NULL;
+		for (uint32_t index = 0; index < pool->block_len && !allocation.block; index++)
+			if (vk_memory_block_alloc(pool->blocks[index], allocation.order, &allocation.offset))
+				allocation.block = pool->blocks[index];
+		if (!allocation.block) {
+			pool->blocks = realloc(pool->blocks, sizeof(struct vk_memory_block*) * (pool->block_len + 1));
+			allocation.block = pool->blocks[pool->block_len++] = vk_memory_block_create(vk, memory_type, (VkDeviceSize)1 << VK_MEMORY_BLOCK_ORDER, false);
+			vk_memory_block_alloc(allocation.block, allocation.order, &allocation.offset);
+		}
+	}
+
+	allocation.memory = allocation.block->memory;
+	allocation.mapped = allocation.block->mapped ? allocation.block->mapped + allocation.offset : NULL;
+	return allocation;
+}
+
+void vk_memory_free(Vulkan* vk, struct vk_allocation* allocation) {
+	if (allocation->block->longest)
+		// Empty blocks are kept for reuse until vk_memory_defragment
+		vk_memory_block_free(allocation->block, allocation->offset, allocation->order);
+	else
+		vk_memory_block_destroy(vk, allocation->block);
+	allocation->block = NULL;
+	allocation->memory = VK_NULL_HANDLE;
+	allocation->mapped = NULL;
+}
+
+struct vk_allocation vk_memory_bind_buffer(Vulkan* vk, VkBuffer buffer, VkMemoryPropertyFlags memory_properties) {
+	VkMemoryRequirements memory_requirements;
+	vkGetBufferMemoryRequirements(vk->device, buffer, &memory_requirements);
+	struct vk_allocation allocation = vk_memory_alloc(vk, memory_requirements, memory_properties, true);
+	if (vkBindBufferMemory(vk->device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS)
+		panic("Unable to bind buffer memory");
+	return allocation;
+}
+
+struct vk_allocation vk_memory_bind_image(Vulkan* vk, VkImage image, VkMemoryPropertyFlags memory_properties) {
+	VkMemoryRequirements memory_requirements;
+	vkGetImageMemoryRequirements(vk->device, image, &memory_requirements);
+	struct vk_allocation allocation = vk_memory_alloc(vk, memory_requirements, memory_properties, false);
+	if (vkBindImageMemory(vk->device, image, allocation.memory, allocation.offset) != VK_SUCCESS)
+		panic("Unable to bind image memory");
+	return allocation;
+}
+
+void vk_memory_defragment(Vulkan* vk) {
+	for (uint32_t memory_type = 0; memory_type < VK_MAX_MEMORY_TYPES; memory_type++)
+		for (uint32_t tiling = 0; tiling < 2; tiling++) {
+			struct vk_memory_pool* pool = &vk->allocator.pools[memory_type][tiling];
+			uint32_t block_len = 0;
+			for (uint32_t index = 0; index < pool->block_len; index++)
+				if (pool->blocks[index]->allocation_len == 0)
+					vk_memory_block_destroy(vk, pool->blocks[index]);
+				else
+					pool->blocks[block_len++] = pool->blocks[index];
+			pool->block_len = block_len;
+			if (block_len == 0) {
+				free(pool->blocks);
+				pool->blocks = NULL;
+			}
+		}
+}
+
+static void vk_descriptor_allocator_setup(struct vk_descriptor_allocator* allocator, VkDescriptorSetLayout layout, VkDescriptorType type) {
+	allocator->layout = layout;
+	allocator->type = type;
+	allocator->pools = NULL;
+	allocator->pool_len = 0;
+	allocator->pool_available = 0;
+	allocator->free_sets = NULL;
+	allocator->free_len = 0;
+}
+
+static void vk_descriptor_allocator_cleanup(Vulkan* vk, struct vk_descriptor_allocator* allocator) {
+	// Destroying a pool frees every set allocated from it
+	for (uint32_t index = 0; index < allocator->pool_len; index++)
+		vkDestroyDescriptorPool(vk->device, allocator->pools[index], NULL);
+	free(allocator->pools);
+	free(allocator->free_sets);
+	allocator->pools = NULL;
+	allocator->pool_len = 0;
+	allocator->pool_available = 0;
+	allocator->free_sets = NULL;
+	allocator->free_len = 0;
+}
+
+/// Chains a pool twice the size of the last one
+static void vk_descriptor_pool_grow(Vulkan* vk, struct vk_descriptor_allocator* allocator) {
+	uint32_t set_len = VK_DESCRIPTOR_POOL_MIN_SETS << (allocator->pool_len < 8 ? allocator->pool_len : 8);
+	VkDescriptorPoolSize vk_pool_size = {
+		.type = allocator->type,
+		.descriptorCount = set_len
+	};
+	VkDescriptorPoolCreateInfo vk_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.poolSizeCount = 1,
+		.pPoolSizes = &vk_pool_size,
+		.maxSets = set_len
+	};
+	allocator->pools = realloc(allocator->pools, sizeof(VkDescriptorPool) * (allocator->pool_len + 1));
+	if (vkCreateDescriptorPool(vk->device, &vk_pool_info, NULL, &allocator->pools[allocator->pool_len]) != VK_SUCCESS)
+		panic("Unable to create descriptor pool");
+	allocator->pool_len++;
+	allocator->pool_available = set_len;
+}
+
+VkDescriptorSet vk_descriptor_alloc(Vulkan* vk, struct vk_descriptor_allocator* allocator) {
+	if (allocator->free_len > 0)
+		return allocator->free_sets[--allocator->free_len];
+
+	if (allocator->pool_available == 0)
+		vk_descriptor_pool_grow(vk, allocator);
+	VkDescriptorSetAllocateInfo vk_set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = allocator->pools[allocator->pool_len - 1],
+		.descriptorSetCount = 1,
+		.pSetLayouts = &allocator->layout
+	};
+	VkDescriptorSet set;
+	VkResult result = vkAllocateDescriptorSets(vk->device, &vk_set_info, &set);
+	// Drivers may run out of pool memory before maxSets is reached
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+		vk_descriptor_pool_grow(vk, allocator);
+		vk_set_info.descriptorPool = allocator->pools[allocator->pool_len - 1];
+		result = vkAllocateDescriptorSets(vk->device, &vk_set_info, &set);
+	}
+	if (result != VK_SUCCESS)
+		panic("Unable to allocate descriptor set");
+	allocator->pool_available--;
+	return set;
+}
+
+void vk_descriptor_free(struct vk_descriptor_allocator* allocator, VkDescriptorSet set) {
+	// Sets of one layout are interchangeable, so they are kept rather than returned to their pool
+	allocator->free_sets = realloc(allocator->free_sets, sizeof(VkDescriptorSet) * (allocator->free_len + 1));
+	allocator->free_sets[allocator->free_len++] = set;
+}
+
+/// Enables bindless textures if the device supports the descriptor indexing they need, unless WAYVK_BINDLESS=0
+static void vk_bindless_config(Vulkan* vk, bool instance_properties2) {
+	struct vk_bindless* bindless = &vk->bindless;
+	bindless->enabled = false;
+	bindless->texture_max = 0;
+	bindless->texture_len = 0;
+	bindless->free_textures = NULL;
+	bindless->free_len = 0;
+
+	const char* config = getenv("WAYVK_BINDLESS");
+	if (!instance_properties2 || (config && strcmp(config, "0") == 0))
+		return;
+	for (uint32_t index = 0; index < sizeof(vk_device_bindless_extensions) / sizeof(*vk_device_bindless_extensions); index++)
+		if (!vk_device_extension_supported(vk->physical_device, vk_device_bindless_extensions[index]))
+			return;
+
+	// Vulkan 1.0 only has the extended queries through the instance extension
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(vk->instance, "vkGetPhysicalDeviceFeatures2KHR");
+	PFN_vkGetPhysicalDeviceProperties2KHR get_properties = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(vk->instance, "vkGetPhysicalDeviceProperties2KHR");
+	if (!get_features || !get_properties)
+		return;
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &indexing_features
+	};
+	get_features(vk->physical_device, &features);
+	if (
+		!features.features.shaderSampledImageArrayDynamicIndexing || !indexing_features.runtimeDescriptorArray ||
+		!indexing_features.descriptorBindingPartiallyBound || !indexing_features.descriptorBindingSampledImageUpdateAfterBind ||
+		!indexing_features.descriptorBindingUpdateUnusedWhilePending
+	)
+		return;
+
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_properties = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT
+	};
+	VkPhysicalDeviceProperties2KHR properties = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+		.pNext = &indexing_properties
+	};
+	get_properties(vk->physical_device, &properties);
+	bindless->texture_max = VK_BINDLESS_MAX_TEXTURES;
+	if (indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages < bindless->texture_max)
+		bindless->texture_max = indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages;
+	if (indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages < bindless->texture_max)
+		bindless->texture_max = indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages;
+	bindless->enabled = bindless->texture_max > 0;
+}
+
+/// Picks a transfer-only queue family for uploads if the device also supports timeline semaphores, unless WAYVK_TRANSFER_QUEUE=0.
+/// Otherwise uploads go to the graphics queue.
+static void vk_transfer_config(Vulkan* vk, bool instance_properties2, const VkQueueFamilyProperties* families, uint32_t family_len) {
+	struct vk_transfer* transfer = &vk->transfer;
+	transfer->enabled = false;
+	transfer->queue_family = vk->queue_family;
+	transfer->value = 0;
+	transfer->completed = 0;
+
+	const char* config = getenv("WAYVK_TRANSFER_QUEUE");
+	if (!instance_properties2 || (config && strcmp(config, "0") == 0))
+		return;
+	if (!vk_device_extension_supported(vk->physical_device, vk_device_timeline_extension))
+		return;
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(vk->instance, "vkGetPhysicalDeviceFeatures2KHR");
+	if (!get_features)
+		return;
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &timeline_features
+	};
+	get_features(vk->physical_device, &features);
+	if (!timeline_features.timelineSemaphore)
+		return;
+
+	// Copy engines have neither graphics nor compute. Glyphs are copied at any offset and size,
+	// so only families that copy at texel granularity qualify.
+	for (uint32_t index = 0; index < family_len; index++) {
+		VkQueueFlags flags = families[index].queueFlags;
+		VkExtent3D granularity = families[index].minImageTransferGranularity;
+		if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			continue;
+		if (granularity.width != 1 || granularity.height != 1 || granularity.depth != 1)
+			continue;
+		transfer->queue_family = index;
+		transfer->enabled = true;
+		return;
+	}
+}
+
+/// Creates the bindless set, which needs the immutable sampler
+static void vk_bindless_setup(Vulkan* vk) {
+	struct vk_bindless* bindless = &vk->bindless;
+	VkDescriptorSetLayoutBinding vk_bindless_bindings[] = {
+		{
+			.binding = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+			.pImmutableSamplers = &vk->glyph_atlas.sampler,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+		},
+		{
+			.binding = 1,
+			.descriptorCount = bindless->texture_max,
+			.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+			.pImmutableSamplers = NULL,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
+		}
+	};
+	// New textures are written while recorded layers still use the set, and most elements never hold one
+	VkDescriptorBindingFlagsEXT vk_bindless_binding_flags[] = {
+		0,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT
+	};
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT vk_bindless_flags_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+		.bindingCount = 2,
+		.pBindingFlags = vk_bindless_binding_flags
+	};
+	VkDescriptorSetLayoutCreateInfo vk_bindless_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &vk_bindless_flags_info,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+		.bindingCount = 2,
+		.pBindings = vk_bindless_bindings
+	};
+	if (vkCreateDescriptorSetLayout(vk->device, &vk_bindless_layout_info, NULL, &bindless->layout) != VK_SUCCESS)
+		panic("Unable to create bindless descriptor set layout");
+
+	VkDescriptorPoolSize vk_bindless_pool_sizes[] = {
+		{ .type = VK_DESCRIPTOR_TYPE_SAMPLER, .descriptorCount = 1 },
+		{ .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, .descriptorCount = bindless->texture_max }
+	};
+	VkDescriptorPoolCreateInfo vk_bindless_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+		.poolSizeCount = 2,
+		.pPoolSizes = vk_bindless_pool_sizes,
+		.maxSets = 1
+	};
+	if (vkCreateDescriptorPool(vk->device, &vk_bindless_pool_info, NULL, &bindless->pool) != VK_SUCCESS)
+		panic("Unable to create bindless descriptor pool");
+	VkDescriptorSetAllocateInfo vk_bindless_set_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = bindless->pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &bindless->layout
+	};
+	if (vkAllocateDescriptorSets(vk->device, &vk_bindless_set_info, &bindless->set) != VK_SUCCESS)
+		panic("Unable to allocate bindless descriptor set");
+}
+
+static void vk_bindless_cleanup(Vulkan* vk) {
+	struct vk_bindless* bindless = &vk->bindless;
+	if (!bindless->enabled)
+		return;
+	vkDestroyDescriptorPool(vk->device, bindless->pool, NULL);
+	vkDestroyDescriptorSetLayout(vk->device, bindless->layout, NULL);
+	free(bindless->free_textures);
+}
+
+uint32_t vk_bindless_texture_add(Vulkan* vk, VkImageView view, VkImageLayout layout) {
+	struct vk_bindless* bindless = &vk->bindless;
+	uint32_t texture;
+	if (bindless->free_len > 0)
+		texture = bindless->free_textures[--bindless->free_len];
+	else if (bindless->texture_len < bindless->texture_max)
+		texture = bindless->texture_len++;
+	else
+		panic("Bindless texture array is full");
+
+	VkDescriptorImageInfo vk_image_info = {
+		.imageView = view,
+		.sampler = VK_NULL_HANDLE,
+		.imageLayout = layout
+	};
+	VkWriteDescriptorSet vk_write = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = bindless->set,
+		.dstBinding = 1,
+		.dstArrayElement = texture,
+		.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+		.descriptorCount = 1,
+		.pImageInfo = &vk_image_info
+	};
+	vkUpdateDescriptorSets(vk->device, 1, &vk_write, 0, NULL);
+	return texture;
+}
+
+void vk_bindless_texture_remove(Vulkan* vk, uint32_t texture) {
+	struct vk_bindless* bindless = &vk->bindless;
+	// The element keeps its stale view until reused, which partially bound arrays allow as long as nothing samples it
+	bindless->free_textures = realloc(bindless->free_textures, sizeof(uint32_t) * (bindless->free_len + 1));
+	bindless->free_textures[bindless->free_len++] = texture;
+}
+
+void vk_defer_deletion(Vulkan* vk, struct vk_deletion deletion) {
+	struct vk_deletion_queue* queue = &vk->deletions;
+	deletion.submit_serial = vk->submit_serial;
+	deletion.upload_value = vk->transfer.value;
+	if (queue->len == queue->capacity) {
+		queue->capacity = queue->capacity ? queue->capacity * 2 : 64;
+		queue->deletions = realloc(queue->deletions, sizeof(struct vk_deletion) * queue->capacity);
+	}
+	queue->deletions[queue->len++] = deletion;
+}
+
+/// The serial up to which every graphics submission has completed
+static uint64_t vk_submit_serial_completed(Vulkan* vk) {
+	uint64_t completed = vk->submit_serial;
+	for (uint32_t output = 0; output < vk->output_len; output++)
+		for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++) {
+			// Fences are only reset under the lease, just before their slot is submitted again
+			InFlight* inflight = &vk->outputs[output].inflight[index];
+			if (inflight->submit_serial <= completed && vkGetFenceStatus(vk->device, inflight->fence) != VK_SUCCESS)
+				completed = inflight->submit_serial - 1;
+		}
+	return completed;
+}
+
+static bool vk_upload_ring_retire(Vulkan*, bool);
+
+void vk_deletion_collect(Vulkan* vk, bool idle) {
+	struct vk_deletion_queue* queue = &vk->deletions;
+	if (queue->len == 0)
+		return;
+	uint64_t submit_completed = vk->submit_serial;
+	uint64_t upload_completed = vk->transfer.value;
+	if (!idle) {
+		vk_upload_ring_retire(vk, false);
+		submit_completed = vk_submit_serial_completed(vk);
+		upload_completed = vk->transfer.completed;
+	}
+
+	// Both values only grow along the queue, so the first deletion still in use ends the scan
+	uint32_t index = 0;
+	for (; index < queue->len; index++) {
+		struct vk_deletion* deletion = &queue->deletions[index];
+		if (deletion->submit_serial > submit_completed || deletion->upload_value > upload_completed)
+			break;
+		switch (deletion->type) {
+			case VK_DELETION_IMAGE:
+				vkDestroyImage(vk->device, deletion->image, NULL);
+				break;
+			case VK_DELETION_IMAGE_VIEW:
+				vkDestroyImageView(vk->device, deletion->view, NULL);
+				break;
+			case VK_DELETION_BUFFER:
+				vkDestroyBuffer(vk->device, deletion->buffer, NULL);
+				break;
+			case VK_DELETION_MEMORY:
+				vk_memory_free(vk, &deletion->memory);
+				break;
+			case VK_DELETION_DESCRIPTOR:
+				vk_descriptor_free(deletion->descriptor.allocator, deletion->descriptor.set);
+				break;
+			case VK_DELETION_BINDLESS_TEXTURE:
+				vk_bindless_texture_remove(vk, deletion->texture);
+				break;
+		}
+	}
+	memmove(queue->deletions, queue->deletions + index, sizeof(struct vk_deletion) * (queue->len - index));
+	queue->len -= index;
+}
+
+static const char* vk_profile_stage_names[VK_PROFILE_STAGE_LEN] = {
+	[VK_PROFILE_RENDER_PASS] = "render pass",
+	[VK_PROFILE_READBACK] = "readback",
+	[VK_PROFILE_UPLOAD] = "upload"
+};
+
+/// Whether queries can be reset from the host, which a Vulkan 1.0 device only does through VK_EXT_host_query_reset
+static bool vk_profiler_host_reset_supported(Vulkan* vk, bool instance_properties2) {
+	if (!instance_properties2 || !vk_device_extension_supported(vk->physical_device, vk_device_host_query_reset_extension))
+		return false;
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(vk->instance, "vkGetPhysicalDeviceFeatures2KHR");
+	if (!get_features)
 		return false;
+	VkPhysicalDeviceHostQueryResetFeaturesEXT host_reset_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &host_reset_features
+	};
+	get_features(vk->physical_device, &features);
+	return host_reset_features.hostQueryReset;
+}
+
+/// Enables timestamp profiling if WAYVK_PROFILE is set and the graphics queue supports timestamps.
+/// Uploads are timed as well when their queue supports timestamps.
+static void vk_profiler_config(Vulkan* vk, bool instance_properties2, const VkQueueFamilyProperties* families) {
+	struct vk_profiler* profiler = &vk->profiler;
+	*profiler = (struct vk_profiler){ 0 };
+	const char* config = getenv("WAYVK_PROFILE");
+	if (!config || strcmp(config, "0") == 0)
+		return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+	uint32_t graphics_bits = families[vk->queue_family].timestampValidBits;
+	if (!properties.limits.timestampComputeAndGraphics || graphics_bits == 0) {
+		fprintf(stderr, "Profiling: the graphics queue does not support timestamps\n");
+		return;
+	}
+	profiler->enabled = true;
+	profiler->period = properties.limits.timestampPeriod;
+	profiler->graphics_mask = graphics_bits == 64 ? UINT64_MAX : ((uint64_t)1 << graphics_bits) - 1;
+
+	uint32_t upload_bits = families[vk->transfer.queue_family].timestampValidBits;
+	if (upload_bits == 0) {
+		fprintf(stderr, "Profiling: the upload queue does not support timestamps\n");
+		return;
+	}
+	// Transfer-only queues cannot reset queries, so their upload slots are reset from the host once read
+	if (vk->transfer.enabled) {
+		profiler->host_reset = vk_profiler_host_reset_supported(vk, instance_properties2);
+		if (!profiler->host_reset) {
+			fprintf(stderr, "Profiling: uploads on the transfer queue are not timed without VK_EXT_host_query_reset\n");
+			return;
+		}
+	}
+	profiler->upload_mask = upload_bits == 64 ? UINT64_MAX : ((uint64_t)1 << upload_bits) - 1;
+}
+
+/// Records the time between two timestamps, reporting the stage whenever a window of samples has been added
+static void vk_profile_sample(Vulkan* vk, enum vk_profile_stage stage, uint64_t begin, uint64_t end, uint64_t mask) {
+	struct vk_profile_samples* samples = &vk->profiler.stages[stage];
+	samples->samples[samples->next] = ((end - begin) & mask) * (double)vk->profiler.period / 1e6;
+	samples->next = (samples->next + 1) % VK_PROFILE_WINDOW;
+	if (samples->sample_len < VK_PROFILE_WINDOW)
+		samples->sample_len++;
+	if (++samples->unreported < VK_PROFILE_WINDOW)
+		return;
+	samples->unreported = 0;
+	struct vk_profile_summary summary = vk_profile_summary(vk, stage);
+	fprintf(stderr, "Profile: %s %.3fms mean, %.3fms min, %.3fms max over %u samples\n", vk_profile_stage_names[stage], summary.mean, summary.min, summary.max, summary.sample_len);
+}
+
+struct vk_profile_summary vk_profile_summary(Vulkan* vk, enum vk_profile_stage stage) {
+	struct vk_profile_samples* samples = &vk->profiler.stages[stage];
+	struct vk_profile_summary summary = { 0 };
+	if (samples->sample_len == 0)
+		return summary;
+	summary.sample_len = samples->sample_len;
+	summary.last = samples->samples[(samples->next + VK_PROFILE_WINDOW - 1) % VK_PROFILE_WINDOW];
+	summary.min = summary.last;
+	summary.max = summary.last;
+	for (uint32_t index = 0; index < samples->sample_len; index++) {
+		double sample = samples->samples[index];
+		summary.mean += sample / samples->sample_len;
+		if (sample < summary.min)
+			summary.min = sample;
+		if (sample > summary.max)
+			summary.max = sample;
+	}
+	return summary;
+}
+
+/// Reads the timestamps of the slot's last frame, which its fence has already shown to be complete
+static void vk_profile_frame_collect(Vulkan* vk, InFlight* inflight) {
+	if (!inflight->profiled)
+		return;
+	inflight->profiled = false;
+	uint32_t query_len = vk->headless.readback ? VK_PROFILE_FRAME_QUERIES : VK_PROFILE_FRAME_QUERIES - 1;
+	uint64_t timestamps[VK_PROFILE_FRAME_QUERIES];
+	if (vkGetQueryPoolResults(vk->device, inflight->query_pool, 0, query_len, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+	vk_profile_sample(vk, VK_PROFILE_RENDER_PASS, timestamps[0], timestamps[1], vk->profiler.graphics_mask);
+	if (vk->headless.readback)
+		vk_profile_sample(vk, VK_PROFILE_READBACK, timestamps[1], timestamps[2], vk->profiler.graphics_mask);
+}
+
+/// Finds a plane that can show the display and is not already used by another output
+static bool vk_display_plane_find(Vulkan* vk, Output* output, VkDisplayPlanePropertiesKHR* planes, uint32_t plane_len, bool* plane_used) {
+	for (uint32_t index = 0; index < plane_len; index++) {
+		if (plane_used[index] || (planes[index].currentDisplay != VK_NULL_HANDLE && planes[index].currentDisplay != output->display))
+			continue;
+		uint32_t supported_len = 0;
+		vkGetDisplayPlaneSupportedDisplaysKHR(vk->physical_device, index, &supported_len, NULL);
+		VkDisplayKHR supported[supported_len];
+		vkGetDisplayPlaneSupportedDisplaysKHR(vk->physical_device, index, &supported_len, supported);
+		for (uint32_t supported_index = 0; supported_index < supported_len; supported_index++) {
+			if (supported[supported_index] == output->display) {
+				output->display_plane = index;
+				output->display_stack = planes[index].currentStackIndex;
+				plane_used[index] = true;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/// Parses WAYVK_MODE as native, refresh or <width>x<height>[@<hz>]
+static void vk_mode_config(Vulkan* vk) {
+	vk->mode_config = (struct vk_mode_config){
+		.policy = VK_MODE_NATIVE,
+		.width = 0,
+		.height = 0,
+		.refresh_rate = 0
+	};
+	const char* config = getenv("WAYVK_MODE");
+	if (!config || strcmp(config, "native") == 0)
+		return;
+	if (strcmp(config, "refresh") == 0) {
+		vk->mode_config.policy = VK_MODE_REFRESH;
+		return;
+	}
+
+	uint32_t refresh_rate = 0;
+	if (sscanf(config, "%ux%u@%u", &vk->mode_config.width, &vk->mode_config.height, &refresh_rate) < 2)
+		panic("WAYVK_MODE must be native, refresh or <width>x<height>[@<hz>]");
+	vk->mode_config.policy = VK_MODE_EXPLICIT;
+	// Display refresh rates are in millihertz
+	vk->mode_config.refresh_rate = refresh_rate * 1000;
+}
+
+/// Whether mode `a` is preferred over `b` by the policy
+static bool vk_mode_better(const VkDisplayPropertiesKHR* display, const struct vk_mode_config* config, const VkDisplayModeParametersKHR* a, const VkDisplayModeParametersKHR* b) {
+	uint64_t a_area = (uint64_t)a->visibleRegion.width * a->visibleRegion.height;
+	uint64_t b_area = (uint64_t)b->visibleRegion.width * b->visibleRegion.height;
+	switch (config->policy) {
+		case VK_MODE_EXPLICIT: {
+			// Only modes of the requested size qualify, then the closest refresh rate wins
+			bool a_size = a->visibleRegion.width == config->width && a->visibleRegion.height == config->height;
+			bool b_size = b->visibleRegion.width == config->width && b->visibleRegion.height == config->height;
+			if (a_size != b_size)
+				return a_size;
+			if (config->refresh_rate) {
+				uint32_t a_distance = a->refreshRate > config->refresh_rate ? a->refreshRate - config->refresh_rate : config->refresh_rate - a->refreshRate;
+				uint32_t b_distance = b->refreshRate > config->refresh_rate ? b->refreshRate - config->refresh_rate : config->refresh_rate - b->refreshRate;
+				if (a_distance != b_distance)
+					return a_distance < b_distance;
+			}
+			return a->refreshRate > b->refreshRate;
+		}
+		case VK_MODE_REFRESH:
+			if (a->refreshRate != b->refreshRate)
+				return a->refreshRate > b->refreshRate;
+			return a_area > b_area;
+		case VK_MODE_NATIVE:
+		default: {
+			bool a_native = a->visibleRegion.width == display->physicalResolution.width && a->visibleRegion.height == display->physicalResolution.height;
+			bool b_native = b->visibleRegion.width == display->physicalResolution.width && b->visibleRegion.height == display->physicalResolution.height;
+			if (a_native != b_native)
+				return a_native;
+			// Displays that misreport their native resolution still get their largest mode
+			if (a_area != b_area)
+				return a_area > b_area;
+			return a->refreshRate > b->refreshRate;
+		}
+	}
+}
+
+/// Picks the display mode the policy prefers, falling back to the native policy if an explicit mode does not exist
+static void vk_display_mode_select(Vulkan* vk, const Output* output, const struct vk_mode_config* config, VkDisplayModePropertiesKHR* mode) {
+	uint32_t display_mode_len = 0;
+	vkGetDisplayModePropertiesKHR(vk->physical_device, output->display, &display_mode_len, NULL);
+	if (display_mode_len == 0)
+		panic("No valid raw Vulkan display mode found");
+	VkDisplayModePropertiesKHR* display_modes = malloc(sizeof(VkDisplayModePropertiesKHR) * display_mode_len);
+	vkGetDisplayModePropertiesKHR(vk->physical_device, output->display, &display_mode_len, display_modes);
+	*mode = display_modes[0];
+	for (uint32_t index = 1; index < display_mode_len; index++)
+		if (vk_mode_better(&output->display_properties, config, &display_modes[index].parameters, &mode->parameters))
+			*mode = display_modes[index];
+	free(display_modes);
+
+	if (config->policy == VK_MODE_EXPLICIT && (mode->parameters.visibleRegion.width != config->width || mode->parameters.visibleRegion.height != config->height)) {
+		fprintf(stderr, "No %ux%u mode, using the native mode instead\n", config->width, config->height);
+		struct vk_mode_config native = { .policy = VK_MODE_NATIVE };
+		vk_display_mode_select(vk, output, &native, mode);
+	}
+}
+
+/// Creates a surface presenting to the output's display in its current mode
+static void vk_display_surface_setup(Vulkan* vk, Output* output) {
+	// Create Display Surface
+	VkDisplaySurfaceCreateInfoKHR vk_surface_info = {
+		.sType = VK_STRUCTURE_TYPE_DISPLAY_SURFACE_CREATE_INFO_KHR,
+		.displayMode = output->display_mode,
+		.planeIndex = output->display_plane,
+		.planeStackIndex = output->display_stack,
+		.transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+		.alphaMode = VK_DISPLAY_PLANE_ALPHA_OPAQUE_BIT_KHR,
+		.imageExtent = output->display_mode_params.visibleRegion
+	};
+
+	if (vkCreateDisplayPlaneSurfaceKHR(vk->instance, &vk_surface_info, NULL, &output->surface) != VK_SUCCESS)
+		panic("Unable to create surface");
+
+	VkBool32 is_supported;
+	if (vkGetPhysicalDeviceSurfaceSupportKHR(vk->physical_device, vk->queue_family, output->surface, &is_supported) != VK_SUCCESS)
+		panic("Unable to determine if the physical device supports a visible surface");
+	if (!is_supported)
+		panic("Visible surface is unsupported by the physical device");
+
+	// Get supported surface formats
+	bool found_format = false;
+	uint32_t format_len = 0;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(vk->physical_device, output->surface, &format_len, NULL);
+	if (format_len == 0)
+		panic("No supported surface formats");
+	VkSurfaceFormatKHR* formats = malloc(sizeof(VkSurfaceFormatKHR) * format_len);
+	vkGetPhysicalDeviceSurfaceFormatsKHR(vk->physical_device, output->surface, &format_len, formats);
+	for (int index = 0; index < format_len; index++) {
+			if (formats[index].format == vk->surface_format.format && formats[index].colorSpace == vk->surface_format.colorSpace) {
+				found_format = true;
+				break;
+			}
+	}
+	free(formats);
+	if (!found_format)
+		panic("Could not find an acceptable surface format");
+
+	output->present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t present_mode_len = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(vk->physical_device, output->surface, &present_mode_len, NULL);
+	if (present_mode_len == 0)
+		panic("No supported present mode");
+	VkPresentModeKHR* present_modes = malloc(sizeof(VkPresentModeKHR) * present_mode_len);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(vk->physical_device, output->surface, &present_mode_len, present_modes);
+	for (int index = 0; index < present_mode_len; index++) {
+		if (present_modes[index] == VK_PRESENT_MODE_MAILBOX_KHR) {
+			output->present_mode = present_modes[index];
+			break;
+		}
+	}
+	free(present_modes);
+}
+
+/// Prepares the per-image framebuffers, which frames create on first use
+static void vk_output_images_setup(Output* output) {
+	output->framebuffers = calloc(output->swapchain_image_len, sizeof(VkFramebuffer));
+}
+
+static void vk_images_cleanup(Vulkan* vk, uint32_t image_len, Image* images, VkFramebuffer* framebuffers) {
+	for (uint32_t index = 0; index < image_len; index++) {
+		if (framebuffers[index] != VK_NULL_HANDLE)
+			vkDestroyFramebuffer(vk->device, framebuffers[index], NULL);
+		vkDestroyImageView(vk->device, images[index].view, NULL);
+	}
+	free(framebuffers);
+}
+
+/// Whether an output's frame has finished, knowing that a slot is only given a new frame once its fence signals
+static bool vk_output_frame_done(Vulkan* vk, Output* output, uint64_t frame, bool wait) {
+	for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++) {
+		if (output->inflight[index].frame != frame)
+			continue;
+		if (wait)
+			return vkWaitForFences(vk->device, 1, &output->inflight[index].fence, VK_TRUE, UINT64_MAX) == VK_SUCCESS;
+		return vkGetFenceStatus(vk->device, output->inflight[index].fence) == VK_SUCCESS;
+	}
+	return true;
+}
+
+/// Destroys retired swapchains whose last frame has finished, or all of them once finished if waiting
+static void vk_output_retired_collect(Vulkan* vk, Output* output, bool wait) {
+	uint32_t kept = 0;
+	for (uint32_t index = 0; index < output->retired_len; index++) {
+		struct vk_retired_swapchain* retired = &output->retired[index];
+		if (!vk_output_frame_done(vk, output, retired->last_frame, wait)) {
+			output->retired[kept++] = *retired;
+			continue;
+		}
+		vk_images_cleanup(vk, retired->image_len, retired->images, retired->framebuffers);
+		free(retired->images);
+		vkDestroySwapchainKHR(vk->device, retired->swapchain, NULL);
+	}
+	output->retired_len = kept;
+}
+
+/// Creates a swapchain for the output's surface, handing any current one over as oldSwapchain so its images stay valid until their frames finish.
+/// Leaves the output without a swapchain if creation fails after the handoff.
+static VkResult vk_output_swapchain_create(Vulkan* vk, Output* output) {
+	VkResult vk_result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk->physical_device, output->surface, &output->surface_capabilities);
+	if (vk_result != VK_SUCCESS)
+		return vk_result;
+	VkExtent2D extent = output->display_mode_params.visibleRegion;
+	if (output->surface_capabilities.currentExtent.width != UINT32_MAX)
+		extent = output->surface_capabilities.currentExtent;
+	// A display being switched off or reconfigured can briefly report nothing to present to
+	if (extent.width == 0 || extent.height == 0)
+		return VK_ERROR_OUT_OF_DATE_KHR;
+
+	VkSwapchainKHR old_swapchain = output->swapchain;
+	if (old_swapchain != VK_NULL_HANDLE) {
+		if (output->retired_len == VK_MAX_RETIRED_SWAPCHAINS)
+			vk_output_retired_collect(vk, output, true);
+		output->retired[output->retired_len++] = (struct vk_retired_swapchain){
+			.swapchain = old_swapchain,
+			.image_len = output->swapchain_image_len,
+			.images = output->swapchain_images,
+			.framebuffers = output->framebuffers,
+			.last_frame = output->frame_count
+		};
+		output->swapchain = VK_NULL_HANDLE;
+		output->swapchain_image_len = 0;
+		output->swapchain_images = NULL;
+		output->framebuffers = NULL;
+	}
+	output->swapchain_extent = extent;
+
+	VkSwapchainCreateInfoKHR vk_swapchain_info = {
+		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+		.surface = output->surface,
+		.minImageCount = output->surface_capabilities.minImageCount + 1 <= output->surface_capabilities.maxImageCount ? output->surface_capabilities.minImageCount + 1 : output->surface_capabilities.minImageCount,
+		.imageFormat = vk->surface_format.format,
+		.imageColorSpace = vk->surface_format.colorSpace,
+		.imageExtent = output->swapchain_extent,
+		.imageArrayLayers = 1,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.preTransform = output->surface_capabilities.currentTransform,
+		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+		.presentMode = output->present_mode,
+		.clipped = VK_TRUE,
+		.oldSwapchain = old_swapchain
+	};
+
+	// The old swapchain is retired even if this fails
+	vk_result = vkCreateSwapchainKHR(vk->device, &vk_swapchain_info, NULL, &output->swapchain);
+	if (vk_result != VK_SUCCESS) {
+		output->swapchain = VK_NULL_HANDLE;
+		return vk_result;
+	}
+
+	// Get the swapchain images
+	vkGetSwapchainImagesKHR(vk->device, output->swapchain, &output->swapchain_image_len, NULL);
+	output->swapchain_images = malloc(sizeof(Image) * output->swapchain_image_len);
+	VkImage* swapchain_image_buffer = malloc(sizeof(VkImage) * output->swapchain_image_len);
+	vkGetSwapchainImagesKHR(vk->device, output->swapchain, &output->swapchain_image_len, swapchain_image_buffer);
+	VkImageViewCreateInfo vk_image_view_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = vk->surface_format.format,
+		.components = { VK_COMPONENT_SWIZZLE_IDENTITY },
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		}
+	};
+	for (int index = 0; index < output->swapchain_image_len; index++) {
+		vk_image_view_info.image = output->swapchain_images[index].image = swapchain_image_buffer[index];
+		if (vkCreateImageView(vk->device, &vk_image_view_info, NULL, &output->swapchain_images[index].view) != VK_SUCCESS)
+			panic("Unable to create swapchain image view");
+	}
+	free(swapchain_image_buffer);
+	vk_output_images_setup(output);
+	output->swapchain_stale = false;
+	return VK_SUCCESS;
+}
+
+
+/// Creates an output for every connected display that a plane can be found for
+static void vk_display_setup(Vulkan* vk) {
+	// Get Display info
+	uint32_t display_len = 0;
+	vkGetPhysicalDeviceDisplayPropertiesKHR(vk->physical_device, &display_len, NULL);
+	if (display_len == 0)
+		panic("Unable to get a direct display");
+	VkDisplayPropertiesKHR* displays = malloc(sizeof(VkDisplayPropertiesKHR) * display_len);
+	vkGetPhysicalDeviceDisplayPropertiesKHR(vk->physical_device, &display_len, displays);
+
+	// Get Display Plane Info
+	uint32_t display_plane_len = 0;
+	vkGetPhysicalDeviceDisplayPlanePropertiesKHR(vk->physical_device, &display_plane_len, NULL);
+	if (display_plane_len == 0)
+		panic("No display planes exist");
+	VkDisplayPlanePropertiesKHR* display_planes = malloc(sizeof(VkDisplayPlanePropertiesKHR) * display_plane_len);
+	vkGetPhysicalDeviceDisplayPlanePropertiesKHR(vk->physical_device, &display_plane_len, display_planes);
+	bool* display_plane_used = calloc(display_plane_len, sizeof(bool));
+
+	vk->outputs = calloc(display_len, sizeof(Output));
+	vk->output_len = 0;
+	for (uint32_t index = 0; index < display_len; index++) {
+		Output* output = &vk->outputs[vk->output_len];
+		output->display = displays[index].display;
+		output->display_properties = displays[index];
+		if (!vk_display_plane_find(vk, output, display_planes, display_plane_len, display_plane_used)) {
+			fprintf(stderr, "No free display plane for %s, leaving it unused\n", displays[index].displayName ? displays[index].displayName : "a display");
+			continue;
+		}
+		VkDisplayModePropertiesKHR mode;
+		vk_display_mode_select(vk, output, &vk->mode_config, &mode);
+		output->display_mode = mode.displayMode;
+		output->display_mode_params = mode.parameters;
+		atomic_init(&output->mode_pending, false);
+		vk_display_surface_setup(vk, output);
+		if (vk_output_swapchain_create(vk, output) != VK_SUCCESS)
+			panic("Unable to create swapchain\nIs the display already in use by Xorg or a Wayland compositor?");
+		vk->output_len++;
+	}
+	free(display_plane_used);
+	free(display_planes);
+	free(displays);
+	if (vk->output_len == 0)
+		panic("Unable to find a suitable display plane");
+}
 
-	*shader_data = malloc(*shader_len);
-	size_t index = 0;
-	for (int byte; (byte = fgetc(shader_file)) != EOF && index < *shader_len; index++)
-		(*shader_data)[index] = (uint8_t)byte;
-	
-	if (ferror(shader_file) || index < *shader_len)
+/// Reads WAYVK_HEADLESS=<width>x<height>[@<hz>], WAYVK_HEADLESS_FRAMES and WAYVK_HEADLESS_CAPTURE
+static void vk_headless_config(Vulkan* vk) {
+	vk->headless.enabled = false;
+	vk->headless.readback = false;
+	vk->headless.frame_limit = 0;
+	vk->headless.capture_path = NULL;
+	const char* config = getenv("WAYVK_HEADLESS");
+	if (!config)
+		return;
+
+	uint32_t width, height, refresh_rate = 60;
+	if (sscanf(config, "%ux%u@%u", &width, &height, &refresh_rate) < 2 || width == 0 || height == 0 || refresh_rate == 0)
+		panic("WAYVK_HEADLESS must be <width>x<height>[@<hz>]");
+	vk->headless.enabled = true;
+	const char* frames = getenv("WAYVK_HEADLESS_FRAMES");
+	if (frames && (sscanf(frames, "%" SCNu64, &vk->headless.frame_limit) != 1 || vk->headless.frame_limit == 0))
+		panic("WAYVK_HEADLESS_FRAMES must be a positive number of frames");
+	// Only the last frame of a limited run is captured
+	vk->headless.capture_path = getenv("WAYVK_HEADLESS_CAPTURE");
+	if (vk->headless.capture_path && !vk->headless.frame_limit)
+		panic("WAYVK_HEADLESS_CAPTURE requires WAYVK_HEADLESS_FRAMES");
+	vk->headless.readback = vk->headless.capture_path != NULL;
+
+	vk->headless.extent = (VkExtent2D){ .width = width, .height = height };
+	// Display refresh rates are in millihertz
+	vk->headless.refresh_rate = refresh_rate * 1000;
+}
+
+/// Creates a single output backed by offscreen images, one per in-flight slot
+static void vk_headless_setup(Vulkan* vk) {
+	vk->outputs = calloc(1, sizeof(Output));
+	vk->output_len = 1;
+	Output* output = &vk->outputs[0];
+	output->display = VK_NULL_HANDLE;
+	output->surface = VK_NULL_HANDLE;
+	output->swapchain = VK_NULL_HANDLE;
+	output->swapchain_extent = vk->headless.extent;
+	output->display_mode_params.visibleRegion = vk->headless.extent;
+	output->display_mode_params.refreshRate = vk->headless.refresh_rate;
+	atomic_init(&output->mode_pending, false);
+
+	output->swapchain_image_len = VK_MAX_INFLIGHT;
+	output->swapchain_images = malloc(sizeof(Image) * output->swapchain_image_len);
+	output->image_memory = malloc(sizeof(struct vk_allocation) * output->swapchain_image_len);
+	output->readback_buffers = NULL;
+	output->readback_memory = NULL;
+	if (vk->headless.readback) {
+		output->readback_buffers = malloc(sizeof(VkBuffer) * output->swapchain_image_len);
+		output->readback_memory = malloc(sizeof(struct vk_allocation) * output->swapchain_image_len);
+	}
+
+	VkImageCreateInfo vk_image_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.extent = {
+				.width = output->swapchain_extent.width,
+				.height = output->swapchain_extent.height,
+				.depth = 1
+			},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.format = vk->surface_format.format,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	VkImageViewCreateInfo vk_image_view_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = vk->surface_format.format,
+		.components = { VK_COMPONENT_SWIZZLE_IDENTITY },
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1
+		}
+	};
+	VkBufferCreateInfo vk_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = (VkDeviceSize)output->swapchain_extent.width * output->swapchain_extent.height * 4,
+		.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	for (uint32_t index = 0; index < output->swapchain_image_len; index++) {
+		if (vkCreateImage(vk->device, &vk_image_info, NULL, &output->swapchain_images[index].image) != VK_SUCCESS)
+			panic("Unable to create headless image");
+		output->image_memory[index] = vk_memory_bind_image(vk, output->swapchain_images[index].image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		vk_image_view_info.image = output->swapchain_images[index].image;
+		if (vkCreateImageView(vk->device, &vk_image_view_info, NULL, &output->swapchain_images[index].view) != VK_SUCCESS)
+			panic("Unable to create headless image view");
+
+		if (vk->headless.readback) {
+			if (vkCreateBuffer(vk->device, &vk_buffer_info, NULL, &output->readback_buffers[index]) != VK_SUCCESS)
+				panic("Unable to create headless readback buffer");
+			output->readback_memory[index] = vk_memory_bind_buffer(vk, output->readback_buffers[index], VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+	}
+	vk_output_images_setup(output);
+}
+
+static void vk_output_images_cleanup(Vulkan* vk, Output* output) {
+	vk_images_cleanup(vk, output->swapchain_image_len, output->swapchain_images, output->framebuffers);
+}
+
+/// Creates a framebuffer for a swapchain image the first time a frame renders to it
+static void vk_output_image_prepare(Vulkan* vk, Output* output, uint32_t image_index) {
+	if (output->framebuffers[image_index] != VK_NULL_HANDLE)
+		return;
+	VkFramebufferCreateInfo vk_framebuffer_info = {
+		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		.renderPass = vk->renderpass,
+		.attachmentCount = 1,
+		.pAttachments = &output->swapchain_images[image_index].view,
+		.width = output->swapchain_extent.width,
+		.height = output->swapchain_extent.height,
+		.layers = 1
+	};
+	if (vkCreateFramebuffer(vk->device, &vk_framebuffer_info, NULL, &output->framebuffers[image_index]) != VK_SUCCESS)
+		panic("Unable to create framebuffer");
+}
+
+/// Creates the frame contexts of an output once the device exists
+static void vk_output_setup(Vulkan* vk, Output* output) {
+	output->current_inflight = 0;
+	pthread_mutex_init(&output->mode_mutex, NULL);
+	output->frame_count = 0;
+	for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++)
+		output->inflight[index] = vk_inflight_setup(vk);
+}
+
+static void vk_output_cleanup(Vulkan* vk, Output* output) {
+	pthread_mutex_destroy(&output->mode_mutex);
+	vk_output_retired_collect(vk, output, true);
+	for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++)
+		vk_inflight_cleanup(vk, &output->inflight[index]);
+	vk_output_images_cleanup(vk, output);
+
+	if (vk->headless.enabled) {
+		for (uint32_t index = 0; index < output->swapchain_image_len; index++) {
+			vkDestroyImage(vk->device, output->swapchain_images[index].image, NULL);
+			vk_memory_free(vk, &output->image_memory[index]);
+			if (vk->headless.readback) {
+				vkDestroyBuffer(vk->device, output->readback_buffers[index], NULL);
+				vk_memory_free(vk, &output->readback_memory[index]);
+			}
+		}
+		free(output->image_memory);
+		free(output->readback_buffers);
+		free(output->readback_memory);
+	} else {
+		vkDestroySwapchainKHR(vk->device, output->swapchain, NULL);
+		vkDestroySurfaceKHR(vk->instance, output->surface, NULL);
+	}
+	free(output->swapchain_images);
+}
+
+void vk_output_request_mode(Output* output, struct vk_mode_config config) {
+	// Headless outputs have no modes to choose from
+	if (output->display == VK_NULL_HANDLE)
+		return;
+	// Requests can follow each other faster than the render thread reads them
+	pthread_mutex_lock(&output->mode_mutex);
+	output->mode_request = config;
+	atomic_store(&output->mode_pending, true);
+	pthread_mutex_unlock(&output->mode_mutex);
+}
+
+bool vk_output_apply_mode(Vulkan* vk, Output* output) {
+	if (!atomic_load(&output->mode_pending))
+		return false;
+	pthread_mutex_lock(&output->mode_mutex);
+	struct vk_mode_config request = output->mode_request;
+	atomic_store(&output->mode_pending, false);
+	pthread_mutex_unlock(&output->mode_mutex);
+	if (output->lost)
+		return false;
+	VkDisplayModePropertiesKHR mode;
+	vk_display_mode_select(vk, output, &request, &mode);
+	if (mode.displayMode == output->display_mode)
 		return false;
 
-	fclose(shader_file);
+	// The surface is tied to the mode and a swapchain can only hand over to one on the same surface,
+	// so the old one goes once its frames finish, which costs at most the frames already in flight
+	if (output->swapchain != VK_NULL_HANDLE) {
+		vk_output_frame_done(vk, output, output->frame_count, true);
+		vk_output_images_cleanup(vk, output);
+		free(output->swapchain_images);
+		vkDestroySwapchainKHR(vk->device, output->swapchain, NULL);
+		output->swapchain = VK_NULL_HANDLE;
+		output->swapchain_image_len = 0;
+		output->swapchain_images = NULL;
+		output->framebuffers = NULL;
+	}
+	vk_output_retired_collect(vk, output, true);
+	vkDestroySurfaceKHR(vk->instance, output->surface, NULL);
+
+	output->display_mode = mode.displayMode;
+	output->display_mode_params = mode.parameters;
+	vk_display_surface_setup(vk, output);
+	// Frames retry the swapchain if the display is not ready for it yet
+	output->swapchain_stale = vk_output_swapchain_create(vk, output) != VK_SUCCESS;
 	return true;
 }
 
-uint32_t vk_find_memory_type(Vulkan* vk, uint32_t memory_type, VkMemoryPropertyFlags memory_properties) {
-	for (uint32_t index = 0; index < vk->physical_device_memory_properties.memoryTypeCount; index++)
-		if (memory_type & (1 << index) && (vk->physical_device_memory_properties.memoryTypes[index].propertyFlags & memory_properties) == memory_properties)
-			return index;
-	panic("Unable to find suitable memory type");
-}
+/// Prints how long a startup phase took and restarts the clock for the next one
+static void vk_startup_phase(const char* phase, struct timespec* start) {
+	fprintf(stderr, "Startup: %s took %.2fms\n", phase, elapsed_ms(start));
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+#define VK_FONT_PATH "/usr/share/fonts/noto/NotoSans-Regular.ttf"
+#define VK_STARTUP_FONT_SIZES 2
+
+/// Font loading and rasterization need no Vulkan, so they run while the device and outputs come up
+struct vk_font_task {
+	Font ft;
+	struct ft_rasterized* rasterized[VK_STARTUP_FONT_SIZES];
+};
+
+static const float vk_startup_font_sizes[VK_STARTUP_FONT_SIZES] = { 12.0f, 24.0f };
+
+static void* vk_font_task_main(void* args) {
+	struct vk_font_task* task = args;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	task->ft = ft_load(VK_FONT_PATH, 24.0f);
+	vk_startup_phase("font load", &start);
+	for (uint32_t index = 0; index < VK_STARTUP_FONT_SIZES; index++)
+		task->rasterized[index] = ft_rasterize(&task->ft, vk_startup_font_sizes[index]);
+	vk_startup_phase("font raster", &start);
+	return NULL;
+}
+
+/// Builds the glyph pipeline, which only needs the device, renderpass and descriptor layout.
+/// Runs on its own thread during output setup, as compilation dominates a cold start.
+static void* vk_glyph_pipeline_main(void* args) {
+	Vulkan* vk = args;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	VkVertexInputBindingDescription vk_glyph_instance_binding = {
+		.binding = 0,
+		.stride = sizeof(struct vk_glyph_instance),
+		.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+	};
+	VkVertexInputAttributeDescription vk_glyph_instance_attributes[] = {
+		{ .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = offsetof(struct vk_glyph_instance, x) },
+		{ .location = 1, .binding = 0, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = offsetof(struct vk_glyph_instance, u) },
+		{ .location = 2, .binding = 0, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = offsetof(struct vk_glyph_instance, colour) }
+	};
+	VkPipelineVertexInputStateCreateInfo vk_vertex_input_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = 1,
+		.pVertexBindingDescriptions = &vk_glyph_instance_binding,
+		.vertexAttributeDescriptionCount = sizeof(vk_glyph_instance_attributes) / sizeof(*vk_glyph_instance_attributes),
+		.pVertexAttributeDescriptions = vk_glyph_instance_attributes
+	};
+	VkPipelineInputAssemblyStateCreateInfo vk_input_assembly_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		.primitiveRestartEnable = VK_FALSE,
+	};
+	// Outputs differ in size, so the viewport and scissor are set by vk_frame_begin
+	VkPipelineViewportStateCreateInfo vk_viewport_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1
+	};
+	VkDynamicState vk_dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo vk_dynamic_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = sizeof(vk_dynamic_states) / sizeof(*vk_dynamic_states),
+		.pDynamicStates = vk_dynamic_states
+	};
+	VkPipelineRasterizationStateCreateInfo vk_raster_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.depthClampEnable = VK_FALSE,
+		.rasterizerDiscardEnable = VK_FALSE,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.lineWidth = 1.0f,
+		.cullMode = VK_CULL_MODE_BACK_BIT,
+		.frontFace = VK_FRONT_FACE_CLOCKWISE,
+		.depthBiasEnable = VK_FALSE,
+	};
+	VkPipelineMultisampleStateCreateInfo vk_multisample_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.sampleShadingEnable = VK_FALSE,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+	};
+	VkPipelineColorBlendAttachmentState vk_framebuffer_blend_state = {
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+		.blendEnable = VK_TRUE,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+		.alphaBlendOp = VK_BLEND_OP_ADD
+	};
+	VkPipelineColorBlendStateCreateInfo vk_framebuffer_blend_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.logicOpEnable = VK_FALSE,
+		.attachmentCount = 1,
+		.pAttachments = &vk_framebuffer_blend_state
+	};
+	VkPushConstantRange vk_push_constant_ranges[] = {
+		{
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+			.offset = 0,
+			.size = sizeof(struct vk_viewport_transform)
+		},
+		{
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.offset = VK_BINDLESS_TEXTURE_OFFSET,
+			.size = sizeof(uint32_t)
+		}
+	};
+	VkPipelineLayoutCreateInfo vk_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = vk->bindless.enabled ? &vk->bindless.layout : &vk->glyph_pipeline.descriptor_layout,
+		.pushConstantRangeCount = vk->bindless.enabled ? 2 : 1,
+		.pPushConstantRanges = vk_push_constant_ranges
+	};
+	if (vkCreatePipelineLayout(vk->device, &vk_layout_info, NULL, &vk->glyph_pipeline.layout) != VK_SUCCESS)
+		panic("Unable to create pipeline layout");
+
+	// Shaders are compiled into the binary, so nothing is read from disk
+	vk->glyph_pipeline.vert_shader = vk_shader_module_create(vk, "basic.vert");
+	vk->glyph_pipeline.frag_shader = vk_shader_module_create(vk, vk->bindless.enabled ? "basic_bindless.frag" : "basic.frag");
+
+	VkPipelineShaderStageCreateInfo vk_vert_stage_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = vk->glyph_pipeline.vert_shader,
+		.pName = "main"
+	};
+	VkPipelineShaderStageCreateInfo vk_frag_stage_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.module = vk->glyph_pipeline.frag_shader,
+		.pName = "main"
+	};
+	VkPipelineShaderStageCreateInfo vk_shader_stages[] = {vk_vert_stage_info, vk_frag_stage_info};
+
+	VkGraphicsPipelineCreateInfo vk_pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.stageCount = 2,
+		.pStages = vk_shader_stages,
+		.pVertexInputState = &vk_vertex_input_info,
+		.pInputAssemblyState = &vk_input_assembly_info,
+		.pViewportState = &vk_viewport_info,
+		.pRasterizationState = &vk_raster_info,
+		.pMultisampleState = &vk_multisample_info,
+		.pDepthStencilState = NULL,
+		.pColorBlendState = &vk_framebuffer_blend_info,
+		.pDynamicState = &vk_dynamic_info,
+		.layout = vk->glyph_pipeline.layout,
+		.renderPass = vk->renderpass,
+		.subpass = 0,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1,
+	};
+	if (vkCreateGraphicsPipelines(vk->device, vk->pipeline_cache, 1, &vk_pipeline_info, NULL, &vk->glyph_pipeline.pipeline) != VK_SUCCESS)
+		panic("Unable to create graphics pipeline");
+	fprintf(stderr, "Startup: pipelines took %.2fms (%s pipeline cache)\n", elapsed_ms(&start), vk->pipeline_cache_warm ? "warm" : "cold");
+	// Save straight away so a crash or a kill still leaves the next boot warm
+	if (!vk->pipeline_cache_warm)
+		vk_pipeline_cache_save(vk);
+	return NULL;
+}
+
+static void vk_upload_ring_setup(Vulkan*);
+static void vk_upload_ring_cleanup(Vulkan*);
 
 Vulkan vk_setup(void) {
 	Vulkan vk;
+	clock_gettime(CLOCK_MONOTONIC, &vk.startup_time);
+	struct timespec phase_start = vk.startup_time;
 	vk.physical_device = VK_NULL_HANDLE;
-	vk.swapchain_image_len = 0;
-	vk.present_mode = VK_PRESENT_MODE_FIFO_KHR;
-	vk.current_inflight = 0;
-
-	vk.ft = ft_load("/usr/share/fonts/noto/NotoSans-Regular.ttf", 24.0f);
+	vk.surface_format = (VkSurfaceFormatKHR){
+		.format = VK_FORMAT_B8G8R8A8_SRGB,
+		.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR
+	};
+	vk.display_control = false;
+	vk.submit_serial = 0;
+	vk.deletions = (struct vk_deletion_queue){ 0 };
+	vk.register_display_event = NULL;
+	vk_headless_config(&vk);
+	vk_mode_config(&vk);
+
+	struct vk_font_task font_task;
+	pthread_t font_thread;
+	if (pthread_create(&font_thread, NULL, vk_font_task_main, &font_task) != 0)
+		panic("Unable to start font loading thread");
 	pthread_mutex_init(&vk.mutex, NULL);
 
 	VkApplicationInfo vk_appinfo = {
@@ -72,11 +1527,23 @@ Vulkan vk_setup(void) {
 		.engineVersion = VK_MAKE_VERSION(0, 0, 1),
 		.apiVersion = VK_API_VERSION_1_0
 	};
+	const size_t vk_instance_extensions_len = sizeof(vk_instance_extensions) / sizeof(*vk_instance_extensions);
+	const char* instance_extensions[vk_instance_extensions_len + 2];
+	memcpy(instance_extensions, vk_instance_extensions, sizeof(vk_instance_extensions));
+	// Offscreen rendering needs no surface or display extensions
+	uint32_t instance_extensions_len = vk.headless.enabled ? 0 : vk_instance_extensions_len;
+	bool instance_display_control = !vk.headless.enabled && vk_instance_extension_supported(vk_instance_display_control_extension);
+	if (instance_display_control)
+		instance_extensions[instance_extensions_len++] = vk_instance_display_control_extension;
+	bool instance_properties2 = vk_instance_extension_supported(vk_instance_properties2_extension);
+	if (instance_properties2)
+		instance_extensions[instance_extensions_len++] = vk_instance_properties2_extension;
+
 	VkInstanceCreateInfo vk_instance_info = {
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pApplicationInfo = &vk_appinfo,
-		.enabledExtensionCount = sizeof(vk_instance_extensions) / sizeof(*vk_instance_extensions),
-		.ppEnabledExtensionNames = vk_instance_extensions,
+		.enabledExtensionCount = instance_extensions_len,
+		.ppEnabledExtensionNames = instance_extensions,
 		#ifdef DEBUG
 			.enabledLayerCount = 1,
 			.ppEnabledLayerNames = vk_validation_layers
@@ -87,6 +1554,7 @@ Vulkan vk_setup(void) {
 
 	if (vkCreateInstance(&vk_instance_info, NULL, &vk.instance) != VK_SUCCESS)
 		panic("Error creating instance");
+	vk_startup_phase("instance", &phase_start);
 
 	uint32_t device_len = 0;
 	vkEnumeratePhysicalDevices(vk.instance, &device_len, NULL);
@@ -115,184 +1583,116 @@ Vulkan vk_setup(void) {
 			break;
 		}
 	}
+	vk_transfer_config(&vk, instance_properties2, queue_family_properties, queue_family_len);
+	vk_profiler_config(&vk, instance_properties2, queue_family_properties);
 	free(queue_family_properties);
 
 	float vk_queue_priorities = { 1.0f };
-	VkDeviceQueueCreateInfo vk_queue_info = {
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = vk.queue_family,
-		.queueCount = 1,
-		.pQueuePriorities = &vk_queue_priorities
+	VkDeviceQueueCreateInfo vk_queue_infos[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = vk.queue_family,
+			.queueCount = 1,
+			.pQueuePriorities = &vk_queue_priorities
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = vk.transfer.queue_family,
+			.queueCount = 1,
+			.pQueuePriorities = &vk_queue_priorities
+		}
 	};
+	vk_bindless_config(&vk, instance_properties2);
 	VkPhysicalDeviceFeatures vk_device_features = {
-		.samplerAnisotropy = VK_TRUE
+		.samplerAnisotropy = VK_TRUE,
+		.shaderSampledImageArrayDynamicIndexing = vk.bindless.enabled
+	};
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT vk_descriptor_indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+		.runtimeDescriptorArray = VK_TRUE,
+		.descriptorBindingPartiallyBound = VK_TRUE,
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingUpdateUnusedWhilePending = VK_TRUE
+	};
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR vk_timeline_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+		.timelineSemaphore = VK_TRUE
+	};
+	VkPhysicalDeviceHostQueryResetFeaturesEXT vk_host_query_reset_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT,
+		.hostQueryReset = VK_TRUE
 	};
+	void* vk_device_features_next = NULL;
+	if (vk.bindless.enabled) {
+		vk_descriptor_indexing_features.pNext = vk_device_features_next;
+		vk_device_features_next = &vk_descriptor_indexing_features;
+	}
+	if (vk.transfer.enabled) {
+		vk_timeline_features.pNext = vk_device_features_next;
+		vk_device_features_next = &vk_timeline_features;
+	}
+	if (vk.profiler.host_reset) {
+		vk_host_query_reset_features.pNext = vk_device_features_next;
+		vk_device_features_next = &vk_host_query_reset_features;
+	}
 	vkGetPhysicalDeviceMemoryProperties(vk.physical_device, &vk.physical_device_memory_properties);
+	memset(&vk.allocator, 0, sizeof(struct vk_allocator));
+
+	const size_t vk_device_extensions_len = sizeof(vk_device_extensions) / sizeof(*vk_device_extensions);
+	const char* device_extensions[vk_device_extensions_len + 5];
+	memcpy(device_extensions, vk_device_extensions, sizeof(vk_device_extensions));
+	uint32_t device_extensions_len = vk.headless.enabled ? 0 : vk_device_extensions_len;
+	vk.display_control = instance_display_control && vk_device_extension_supported(vk.physical_device, vk_device_display_control_extension);
+	if (vk.display_control)
+		device_extensions[device_extensions_len++] = vk_device_display_control_extension;
+	if (vk.bindless.enabled)
+		for (uint32_t index = 0; index < sizeof(vk_device_bindless_extensions) / sizeof(*vk_device_bindless_extensions); index++)
+			device_extensions[device_extensions_len++] = vk_device_bindless_extensions[index];
+	if (vk.transfer.enabled)
+		device_extensions[device_extensions_len++] = vk_device_timeline_extension;
+	if (vk.profiler.host_reset)
+		device_extensions[device_extensions_len++] = vk_device_host_query_reset_extension;
 
 	VkDeviceCreateInfo vk_device_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.queueCreateInfoCount = 1,
-		.pQueueCreateInfos = &vk_queue_info,
+		.pNext = vk_device_features_next,
+		.queueCreateInfoCount = vk.transfer.enabled ? 2 : 1,
+		.pQueueCreateInfos = vk_queue_infos,
 		.pEnabledFeatures = &vk_device_features,
-		.enabledExtensionCount = sizeof(vk_device_extensions) / sizeof(*vk_device_extensions),
-		.ppEnabledExtensionNames = vk_device_extensions
+		.enabledExtensionCount = device_extensions_len,
+		.ppEnabledExtensionNames = device_extensions
 	};
 	if (vkCreateDevice(vk.physical_device, &vk_device_info, NULL, &vk.device) != VK_SUCCESS)
 		panic("Unable to create device");
 	vkGetDeviceQueue(vk.device, vk.queue_family, 0, &vk.queue);
-
-	// Get Display info
-	uint32_t display_len = 0;
-	vkGetPhysicalDeviceDisplayPropertiesKHR(vk.physical_device, &display_len, NULL);
-	if (display_len == 0)
-		panic("Unable to get a direct display");
-	VkDisplayPropertiesKHR* displays = malloc(sizeof(VkDisplayPropertiesKHR) * display_len);
-	vkGetPhysicalDeviceDisplayPropertiesKHR(vk.physical_device, &display_len, displays);
-	for (int index = 0; index < display_len; index++) {
-		vk.display = displays[index].display;
-		vk.display_properties = displays[index];
-		break;
-	}
-	free(displays);
-
-	// Get Display Plane Info
-	bool display_plane_found = false;
-	uint32_t display_properties_len = 0;
-	vkGetPhysicalDeviceDisplayPlanePropertiesKHR(vk.physical_device, &display_properties_len, NULL);
-	if (display_properties_len == 0)
-		panic("No display planes exist");
-	VkDisplayPlanePropertiesKHR* display_properties = malloc(sizeof(VkDisplayPlanePropertiesKHR) * display_properties_len);
-	vkGetPhysicalDeviceDisplayPlanePropertiesKHR(vk.physical_device, &display_properties_len, display_properties);
-	for (int index = 0; index < display_properties_len; index++) {
-		if (display_properties[index].currentDisplay == NULL || display_properties[index].currentDisplay == vk.display) {
-			vk.display_plane = index;
-			vk.display_stack = display_properties[index].currentStackIndex;
-			display_plane_found = true;
-			break;
-		}
+	vk.transfer.queue = vk.queue;
+	if (vk.transfer.enabled) {
+		vkGetDeviceQueue(vk.device, vk.transfer.queue_family, 0, &vk.transfer.queue);
+		VkSemaphoreTypeCreateInfoKHR vk_timeline_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+			.initialValue = 0
+		};
+		VkSemaphoreCreateInfo vk_semaphore_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &vk_timeline_info
+		};
+		if (vkCreateSemaphore(vk.device, &vk_semaphore_info, NULL, &vk.transfer.timeline) != VK_SUCCESS)
+			panic("Unable to create transfer timeline semaphore");
 	}
-	free(display_properties);
-	if (!display_plane_found)
-		panic("Unable to find a suitable display plane");
-
-	// Get Raw Display Mode Info
-	uint32_t display_mode_len = 0;
-	vkGetDisplayModePropertiesKHR(vk.physical_device, vk.display, &display_mode_len, NULL);
-	if (display_mode_len == 0)
-		panic("No valid raw Vulkan display mode found");
-	VkDisplayModePropertiesKHR* display_modes = malloc(sizeof(VkDisplayModePropertiesKHR) * display_mode_len);
-	vkGetDisplayModePropertiesKHR(vk.physical_device, vk.display, &display_mode_len, display_modes);
-	for (int index = 0; index < display_mode_len; index++) {
-		vk.display_mode = display_modes[index].displayMode;
-		vk.display_mode_params = display_modes[index].parameters;
-		break;
-	}
-	free(display_modes);
 
-	// Create Display Surface
-	VkDisplaySurfaceCreateInfoKHR vk_surface_info = {
-		.sType = VK_STRUCTURE_TYPE_DISPLAY_SURFACE_CREATE_INFO_KHR,
-		.displayMode = vk.display_mode,
-		.planeIndex = vk.display_plane,
-		.planeStackIndex = vk.display_stack,
-		.transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
-		.alphaMode = VK_DISPLAY_PLANE_ALPHA_OPAQUE_BIT_KHR,
-		.imageExtent = vk.display_mode_params.visibleRegion
-	};
-
-	if (vkCreateDisplayPlaneSurfaceKHR(vk.instance, &vk_surface_info, NULL, &vk.surface) != VK_SUCCESS)
-		panic("Unable to create surface");
-
-	VkBool32 is_supported;
-	if (vkGetPhysicalDeviceSurfaceSupportKHR(vk.physical_device, vk.queue_family, vk.surface, &is_supported) != VK_SUCCESS)
-		panic("Unable to determine if the physical device supports a visible surface");
-	if (!is_supported)
-		panic("Visible surface is unsupported by the physical device");
-
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk.physical_device, vk.surface, &vk.surface_capabilities);
-	
-	// Get supported surface formats
-	bool found_format = false;
-	uint32_t format_len = 0;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(vk.physical_device, vk.surface, &format_len, NULL);
-	if (format_len == 0)
-		panic("No supported surface formats");
-	VkSurfaceFormatKHR* formats = malloc(sizeof(VkSurfaceFormatKHR) * format_len);
-	vkGetPhysicalDeviceSurfaceFormatsKHR(vk.physical_device, vk.surface, &format_len, formats);
-	for (int index = 0; index < format_len; index++) {
-			if (formats[index].format == VK_FORMAT_B8G8R8A8_SRGB && formats[index].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-				vk.surface_format = formats[index];
-				found_format = true;
-				break;
-			}
+	// Extension functions are not exported by the loader
+	if (vk.display_control) {
+		vk.register_display_event = (PFN_vkRegisterDisplayEventEXT)vkGetDeviceProcAddr(vk.device, "vkRegisterDisplayEventEXT");
+		vk.display_control = vk.register_display_event != NULL;
 	}
-	free(formats);
-	if (!found_format)
-		panic("Could not find an acceptable surface format");
-
-	uint32_t present_mode_len = 0;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(vk.physical_device, vk.surface, &present_mode_len, NULL);
-	if (present_mode_len == 0)
-		panic("No supported present mode");
-	VkPresentModeKHR* present_modes = malloc(sizeof(VkPresentModeKHR) * present_mode_len);
-	vkGetPhysicalDeviceSurfacePresentModesKHR(vk.physical_device, vk.surface, &present_mode_len, present_modes);
-	for (int index = 0; index < present_mode_len; index++) {
-		if (present_modes[index] == VK_PRESENT_MODE_MAILBOX_KHR) {
-			vk.present_mode = present_modes[index];
-			break;
-		}
+	if (vk.profiler.host_reset) {
+		vk.profiler.reset_query_pool = (PFN_vkResetQueryPoolEXT)vkGetDeviceProcAddr(vk.device, "vkResetQueryPoolEXT");
+		if (!vk.profiler.reset_query_pool)
+			vk.profiler.upload_mask = 0;
 	}
-	free(present_modes);
-
-	if (vk.surface_capabilities.currentExtent.width != UINT32_MAX)
-		vk.swapchain_extent = vk.surface_capabilities.currentExtent;
-	else
-		vk.swapchain_extent = vk.display_mode_params.visibleRegion;
-
-	VkSwapchainCreateInfoKHR vk_swapchain_info = {
-		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-		.surface = vk.surface,
-		.minImageCount = vk.surface_capabilities.minImageCount + 1 <= vk.surface_capabilities.maxImageCount ? vk.surface_capabilities.minImageCount + 1 : vk.surface_capabilities.minImageCount,
-		.imageFormat = vk.surface_format.format,
-		.imageColorSpace = vk.surface_format.colorSpace,
-		.imageExtent = vk.swapchain_extent,
-		.imageArrayLayers = 1,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.preTransform = vk.surface_capabilities.currentTransform,
-		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-		.presentMode = vk.present_mode,
-		.clipped = VK_TRUE,
-		.oldSwapchain = VK_NULL_HANDLE
-	};
 
-	if (vkCreateSwapchainKHR(vk.device, &vk_swapchain_info, NULL, &vk.swapchain) != VK_SUCCESS)
-		panic("Unable to create swapchain\nIs the display already in use by Xorg or a Wayland compositor?");
-
-	// Get the swapchain images
-	vkGetSwapchainImagesKHR(vk.device, vk.swapchain, &vk.swapchain_image_len, NULL);
-	vk.swapchain_images = malloc(sizeof(Image) * vk.swapchain_image_len);
-	VkImage* swapchain_image_buffer = malloc(sizeof(VkImage) * vk.swapchain_image_len);
-	vkGetSwapchainImagesKHR(vk.device, vk.swapchain, &vk.swapchain_image_len, swapchain_image_buffer);
-	VkImageViewCreateInfo vk_image_view_info = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-		.viewType = VK_IMAGE_VIEW_TYPE_2D,
-		.format = vk.surface_format.format,
-		.components = { VK_COMPONENT_SWIZZLE_IDENTITY },
-		.subresourceRange = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		}
-	};
-	for (int index = 0; index < vk.swapchain_image_len; index++) {
-		vk_image_view_info.image = vk.swapchain_images[index].image = swapchain_image_buffer[index];
-		if (vkCreateImageView(vk.device, &vk_image_view_info, NULL, &vk.swapchain_images[index].view) != VK_SUCCESS)
-			panic("Unable to create swapchain image view");
-	}
-	free(swapchain_image_buffer);
+	vk_startup_phase("device", &phase_start);
 
 	// Create the main renderpass
 
@@ -304,7 +1704,8 @@ Vulkan vk_setup(void) {
 		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
 		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+		// Headless images are only ever read back
+		.finalLayout = vk.headless.enabled ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
 	};
 	VkAttachmentReference vk_framebuffer_attachment_reference = {
 		.attachment = 0,
@@ -337,260 +1738,385 @@ Vulkan vk_setup(void) {
 	if (vkCreateRenderPass(vk.device, &vk_renderpass_info, NULL, &vk.renderpass) != VK_SUCCESS)
 		panic("Unable to create renderpass");
 
-
-	// Create framebuffers
-	vk.framebuffers = malloc(sizeof(VkFramebuffer) * vk.swapchain_image_len);
-	VkFramebufferCreateInfo vk_framebuffer_info = {
-		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-		.renderPass = vk.renderpass,
-		.attachmentCount = 1,
-		.width = vk.swapchain_extent.width,
-		.height = vk.swapchain_extent.height,
-		.layers = 1
-	};
-	for (int index = 0; index < vk.swapchain_image_len; index++) {
-		vk_framebuffer_info.pAttachments = &vk.swapchain_images[index].view;
-		if (vkCreateFramebuffer(vk.device, &vk_framebuffer_info, NULL, &vk.framebuffers[index]) != VK_SUCCESS)
-			panic("Unable to create framebuffer");
-	}
-
-	// Create command buffers
-	VkCommandPoolCreateInfo vk_command_pool_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-		.queueFamilyIndex = vk.queue_family,
-	};
-	if (vkCreateCommandPool(vk.device, &vk_command_pool_info, NULL, &vk.command_pool) != VK_SUCCESS)
-		panic("Unable to create command pool");
-
-	VkCommandBufferAllocateInfo vk_command_buffer_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = vk.command_pool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = vk.swapchain_image_len
+	// Every atlas page shares one sampler, baked into the descriptor layout
+	VkSamplerCreateInfo vk_sampler_info = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
+		.anisotropyEnable = VK_TRUE,
+		.maxAnisotropy = 16.0f,
+		.borderColor = VK_BORDER_COLOR_INT_TRANSPARENT_BLACK,
+		.unnormalizedCoordinates = VK_FALSE,
+		.compareEnable = VK_FALSE,
+		.compareOp = VK_COMPARE_OP_ALWAYS,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.mipLodBias = 0.0f,
+		.minLod = 0.0f,
+		.maxLod = 0.0f,
 	};
-	vk.command_buffers = malloc(sizeof(VkCommandBuffer) * vk.swapchain_image_len);
-	if (vkAllocateCommandBuffers(vk.device, &vk_command_buffer_info, vk.command_buffers) != VK_SUCCESS)
-		panic("Unable to allocate command buffers");
-
-	// Create in-flight synchronization primitives
-	for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++)
-		vk.inflight[index] = vk_inflight_setup(&vk);
+	if (vkCreateSampler(vk.device, &vk_sampler_info, NULL, &vk.glyph_atlas.sampler) != VK_SUCCESS)
+		panic("Unable to create glyph atlas sampler");
 
-	
-	// Create descriptors
+	// Create the glyph descriptor layout
 	VkDescriptorSetLayoutBinding vk_glyph_sampler_binding = {
 		.binding = 0,
 		.descriptorCount = 1,
 		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.pImmutableSamplers = NULL,
+		.pImmutableSamplers = &vk.glyph_atlas.sampler,
 		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT
 	};
 	VkDescriptorSetLayoutCreateInfo vk_glyph_descriptor_layout_info = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.bindingCount = 1,
-		.pBindings = &vk_glyph_sampler_binding,
-	};
-	if (vkCreateDescriptorSetLayout(vk.device, &vk_glyph_descriptor_layout_info, NULL, &vk.glyph_pipeline.descriptor_layout) != VK_SUCCESS)
-		panic("Unable to create glyph descriptor set layout");
-
-	VkDescriptorPoolSize vk_glyph_sampler_pool_size = {
-		.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = 255 // TODO: real count
-	};
-	VkDescriptorPoolCreateInfo vk_glyph_descriptor_pool_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.poolSizeCount = 1,
-		.pPoolSizes = &vk_glyph_sampler_pool_size,
-		.maxSets = 255 // TODO: real count
-	};
-	if (vkCreateDescriptorPool(vk.device, &vk_glyph_descriptor_pool_info, NULL, &vk.glyph_pipeline.descriptor_pool) != VK_SUCCESS)
-		panic("Unable to create descriptor pool");
-	//VkDescriptorSetLayout* vk_glyph_pool_layouts = malloc(sizeof(VkDescriptorSetLayout) * vk.swapchain_image_len);
-	//for (size_t index = 0; index < vk.swapchain_image_len; index++)
-	//	vk_glyph_pool_layouts[index] = vk.glyph_pipeline.descriptor_layout;
-	
-	// Create the graphics pipeline
-	VkPipelineVertexInputStateCreateInfo vk_vertex_input_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 0,
-		.vertexAttributeDescriptionCount = 0,
-	};
-	VkPipelineInputAssemblyStateCreateInfo vk_input_assembly_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-		.primitiveRestartEnable = VK_FALSE,
-	};
-	VkViewport vk_viewport = {
-		.x = 0.0f,
-		.y = 0.0f,
-		.width = (float) vk.swapchain_extent.width,
-		.height = (float) vk.swapchain_extent.height,
-		.minDepth = 0.0f,
-		.maxDepth = 1.0f
-	};
-	VkRect2D vk_scissor = {
-		.offset = { 0 },
-		.extent = vk.swapchain_extent
-	};
-	VkPipelineViewportStateCreateInfo vk_viewport_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.viewportCount = 1,
-		.pViewports = &vk_viewport,
-		.scissorCount = 1,
-		.pScissors = &vk_scissor
-	};
-	VkPipelineRasterizationStateCreateInfo vk_raster_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-		.depthClampEnable = VK_FALSE,
-		.rasterizerDiscardEnable = VK_FALSE,
-		.polygonMode = VK_POLYGON_MODE_FILL,
-		.lineWidth = 1.0f,
-		.cullMode = VK_CULL_MODE_BACK_BIT,
-		.frontFace = VK_FRONT_FACE_CLOCKWISE,
-		.depthBiasEnable = VK_FALSE,
-	};
-	VkPipelineMultisampleStateCreateInfo vk_multisample_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-		.sampleShadingEnable = VK_FALSE,
-		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
-	};
-	VkPipelineColorBlendAttachmentState vk_framebuffer_blend_state = {
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-		.blendEnable = VK_TRUE,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-		.colorBlendOp = VK_BLEND_OP_ADD,
-		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-		.alphaBlendOp = VK_BLEND_OP_ADD
-	};
-	VkPipelineColorBlendStateCreateInfo vk_framebuffer_blend_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.logicOpEnable = VK_FALSE,
-		.attachmentCount = 1,
-		.pAttachments = &vk_framebuffer_blend_state
-	};
-	VkPushConstantRange vk_push_constant = {
-		.offset = 0,
-		.size = sizeof(struct vk_glyph_push_constant),
-		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT
-	};
-	VkPipelineLayoutCreateInfo vk_layout_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-		.setLayoutCount = 1,
-		.pSetLayouts = &vk.glyph_pipeline.descriptor_layout,
-		.pushConstantRangeCount = 1,
-		.pPushConstantRanges = &vk_push_constant
-	};
-	if (vkCreatePipelineLayout(vk.device, &vk_layout_info, NULL, &vk.glyph_pipeline.layout) != VK_SUCCESS)
-		panic("Unable to create pipeline layout");
-
-	// Load shaders
-	size_t vert_shader_len;
-	uint8_t* vert_shader;
-	size_t frag_shader_len;
-	uint8_t* frag_shader;
-
-	if (!load_shader("shader/basic.vert.spv", &vert_shader, &vert_shader_len))
-		panic("Failed to load vertex shader");
-	if (!load_shader("shader/basic.frag.spv", &frag_shader, &frag_shader_len))
-		panic("Failed to load fragment shader");
-
-	VkShaderModuleCreateInfo vk_vert_shader_info = {
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = vert_shader_len,
-		.pCode = (uint32_t*)vert_shader
-	};
-	if (vkCreateShaderModule(vk.device, &vk_vert_shader_info, NULL, &vk.glyph_pipeline.vert_shader) != VK_SUCCESS) {
-		free(vert_shader);
-		panic("Unable to create vertex shader module");
-	}
-	free(vert_shader);
-	VkShaderModuleCreateInfo vk_frag_shader_info = {
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = frag_shader_len,
-		.pCode = (uint32_t*)frag_shader
-	};
-	if (vkCreateShaderModule(vk.device, &vk_frag_shader_info, NULL, &vk.glyph_pipeline.frag_shader) != VK_SUCCESS) {
-		free(frag_shader);
-		panic("Unable to create fragment shader module");
-	}
-	free(frag_shader);
-	
-	VkPipelineShaderStageCreateInfo vk_vert_stage_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.stage = VK_SHADER_STAGE_VERTEX_BIT,
-		.module = vk.glyph_pipeline.vert_shader,
-		.pName = "main"
-	};
-	VkPipelineShaderStageCreateInfo vk_frag_stage_info = {
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-		.module = vk.glyph_pipeline.frag_shader,
-		.pName = "main"
-	};
-	VkPipelineShaderStageCreateInfo vk_shader_stages[] = {vk_vert_stage_info, vk_frag_stage_info};
-
-	VkGraphicsPipelineCreateInfo vk_pipeline_info = {
-		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-		.stageCount = 2,
-		.pStages = vk_shader_stages,
-		.pVertexInputState = &vk_vertex_input_info,
-		.pInputAssemblyState = &vk_input_assembly_info,
-		.pViewportState = &vk_viewport_info,
-		.pRasterizationState = &vk_raster_info,
-		.pMultisampleState = &vk_multisample_info,
-		.pDepthStencilState = NULL,
-		.pColorBlendState = &vk_framebuffer_blend_info,
-		.pDynamicState = NULL,
-		.layout = vk.glyph_pipeline.layout,
-		.renderPass = vk.renderpass,
-		.subpass = 0,
-		.basePipelineHandle = VK_NULL_HANDLE,
-		.basePipelineIndex = -1,
+		.pBindings = &vk_glyph_sampler_binding,
 	};
-	if (vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &vk_pipeline_info, NULL, &vk.glyph_pipeline.pipeline) != VK_SUCCESS)
-		panic("Unable to create graphics pipeline");
+	if (vkCreateDescriptorSetLayout(vk.device, &vk_glyph_descriptor_layout_info, NULL, &vk.glyph_pipeline.descriptor_layout) != VK_SUCCESS)
+		panic("Unable to create glyph descriptor set layout");
+	vk_descriptor_allocator_setup(&vk.glyph_pipeline.descriptors, vk.glyph_pipeline.descriptor_layout, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	if (vk.bindless.enabled)
+		vk_bindless_setup(&vk);
+
+	// The pipeline compiles while the outputs and their swapchains are set up
+	vk_pipeline_cache_setup(&vk);
+	pthread_t pipeline_thread;
+	if (pthread_create(&pipeline_thread, NULL, vk_glyph_pipeline_main, &vk) != 0)
+		panic("Unable to start pipeline build thread");
+
+	if (vk.headless.enabled)
+		vk_headless_setup(&vk);
+	else
+		vk_display_setup(&vk);
+
+	// Create the upload command pool
+	VkCommandPoolCreateInfo vk_command_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = vk.transfer.queue_family,
+	};
+	if (vkCreateCommandPool(vk.device, &vk_command_pool_info, NULL, &vk.command_pool) != VK_SUCCESS)
+		panic("Unable to create command pool");
 
-	// Pre-raster font images
-	ft_raster(&vk.ft, &vk, 12.0f);
-	ft_raster(&vk.ft, &vk, 24.0f);
+	vk_upload_ring_setup(&vk);
 
+	for (uint32_t index = 0; index < vk.output_len; index++)
+		vk_output_setup(&vk, &vk.outputs[index]);
+	vk_startup_phase("outputs", &phase_start);
+
+	VkBufferCreateInfo vk_zero_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = VK_GLYPH_ATLAS_SIZE * VK_GLYPH_ATLAS_ZERO_ROWS,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE
+	};
+	if (vkCreateBuffer(vk.device, &vk_zero_buffer_info, NULL, &vk.glyph_atlas.zero_buffer) != VK_SUCCESS)
+		panic("Failed to create glyph atlas zero buffer");
+	vk.glyph_atlas.zero_memory = vk_memory_bind_buffer(&vk, vk.glyph_atlas.zero_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	memset(vk.glyph_atlas.zero_memory.mapped, 0, vk_zero_buffer_info.size);
+	vk.glyph_atlas.pages = NULL;
+	vk.glyph_atlas.page_len = 0;
+	vk.glyph_atlas.generation = 0;
+
+	// Upload the pre-rasterized glyphs while the pipeline may still be compiling
+	pthread_join(font_thread, NULL);
+	vk.ft = font_task.ft;
+	for (uint32_t index = 0; index < VK_STARTUP_FONT_SIZES; index++)
+		ft_upload(&vk.ft, &vk, font_task.rasterized[index]);
+	vk_startup_phase("font wait and upload", &phase_start);
+
+	pthread_join(pipeline_thread, NULL);
+	fprintf(stderr, "Startup: Vulkan ready after %.2fms\n", elapsed_ms(&vk.startup_time));
 	return vk;
 }
 
 void vk_cleanup(Vulkan* vk) {
 	vkDeviceWaitIdle(vk->device);
-	for (uint_fast8_t index = 0; index < VK_MAX_INFLIGHT; index++)
-		vk_inflight_cleanup(vk, &vk->inflight[index]);
-	vkFreeCommandBuffers(vk->device, vk->command_pool, vk->swapchain_image_len, vk->command_buffers);
-	free(vk->command_buffers);
+	for (uint32_t index = 0; index < vk->output_len; index++)
+		vk_output_cleanup(vk, &vk->outputs[index]);
+	free(vk->outputs);
+	vk_upload_ring_cleanup(vk);
 	vkDestroyCommandPool(vk->device, vk->command_pool, NULL);
+	if (vk->transfer.enabled)
+		vkDestroySemaphore(vk->device, vk->transfer.timeline, NULL);
 
 	ft_unload(vk->ft, vk);
-	vkDestroyDescriptorPool(vk->device, vk->glyph_pipeline.descriptor_pool, NULL);
+	vk_glyph_atlas_reset(vk);
+	vk_deletion_collect(vk, true);
+	free(vk->deletions.deletions);
+	vkDestroyBuffer(vk->device, vk->glyph_atlas.zero_buffer, NULL);
+	vk_memory_free(vk, &vk->glyph_atlas.zero_memory);
+	vk_descriptor_allocator_cleanup(vk, &vk->glyph_pipeline.descriptors);
 	vkDestroyDescriptorSetLayout(vk->device, vk->glyph_pipeline.descriptor_layout, NULL);
+	vk_bindless_cleanup(vk);
+	vkDestroySampler(vk->device, vk->glyph_atlas.sampler, NULL);
 	vkDestroyPipeline(vk->device, vk->glyph_pipeline.pipeline, NULL);
+	vk_pipeline_cache_save(vk);
+	vkDestroyPipelineCache(vk->device, vk->pipeline_cache, NULL);
+	free(vk->pipeline_cache_path);
 	vkDestroyPipelineLayout(vk->device, vk->glyph_pipeline.layout, NULL);
 	vkDestroyShaderModule(vk->device, vk->glyph_pipeline.vert_shader, NULL);
 	vkDestroyShaderModule(vk->device, vk->glyph_pipeline.frag_shader, NULL);
 
-	for (int index = 0; index < vk->swapchain_image_len; index++)
-		vkDestroyFramebuffer(vk->device, vk->framebuffers[index], NULL);
-	free(vk->framebuffers);
 	vkDestroyRenderPass(vk->device, vk->renderpass, NULL);
-	for (int index = 0; index < vk->swapchain_image_len; index++)
-		vkDestroyImageView(vk->device, vk->swapchain_images[index].view, NULL);
-	free(vk->swapchain_images);
-	vkDestroySwapchainKHR(vk->device, vk->swapchain, NULL);
-	vkDestroySurfaceKHR(vk->instance, vk->surface, NULL);
+	// Every allocation has been freed, so this releases all remaining blocks
+	vk_memory_defragment(vk);
 	vkDestroyDevice(vk->device, NULL);
 	vkDestroyInstance(vk->instance, NULL);
 
 	pthread_mutex_destroy(&vk->mutex);
 }
 
+void vk_lease_acquire(Vulkan* vk) {
+	pthread_mutex_lock(&vk->mutex);
+}
+
+void vk_lease_release(Vulkan* vk) {
+	pthread_mutex_unlock(&vk->mutex);
+}
+
+/// Stops rendering to an output whose display has been disconnected
+static void vk_output_lose(Output* output) {
+	fprintf(stderr, "%s was disconnected, no longer rendering to it\n", output->display_properties.displayName ? output->display_properties.displayName : "A display");
+	output->lost = true;
+}
+
+/// Replaces a stale swapchain, leaving it stale to retry next frame if the display is not ready
+static bool vk_output_swapchain_rebuild(Vulkan* vk, Output* output) {
+	switch (vk_output_swapchain_create(vk, output)) {
+		case VK_SUCCESS:
+			return true;
+		case VK_ERROR_SURFACE_LOST_KHR:
+			vk_output_lose(output);
+			return false;
+		default:
+			output->swapchain_stale = true;
+			return false;
+	}
+}
+
+bool vk_frame_begin(Vulkan* vk, Output* output, struct vk_frame* frame) {
+	if (output->lost)
+		return false;
+	uint_fast8_t next_inflight = (output->current_inflight + 1) % VK_MAX_INFLIGHT;
+	InFlight* inflight = &output->inflight[next_inflight];
+	vkWaitForFences(vk->device, 1, &inflight->fence, VK_TRUE, UINT64_MAX);
+	vk_output_retired_collect(vk, output, false);
+
+	// Each headless image belongs to one in-flight slot, so its fence already guards it
+	VkResult vk_result = VK_SUCCESS;
+	if (vk->headless.enabled) {
+		frame->image_index = next_inflight;
+	} else {
+		if (output->swapchain_stale && !vk_output_swapchain_rebuild(vk, output))
+			return false;
+		vk_result = vkAcquireNextImageKHR(vk->device, output->swapchain, UINT64_MAX, inflight->render_semaphore, VK_NULL_HANDLE, &frame->image_index);
+		// Rebuilding straight away means a mode switch or hotplug costs this attempt at most
+		if (vk_result == VK_ERROR_OUT_OF_DATE_KHR && vk_output_swapchain_rebuild(vk, output))
+			vk_result = vkAcquireNextImageKHR(vk->device, output->swapchain, UINT64_MAX, inflight->render_semaphore, VK_NULL_HANDLE, &frame->image_index);
+	}
+	switch (vk_result) {
+		case VK_SUCCESS:
+			break;
+		case VK_SUBOPTIMAL_KHR:
+			// The image is acquired and still presentable, so draw it and rebuild before the next frame
+			output->swapchain_stale = true;
+			break;
+		case VK_TIMEOUT:
+		case VK_NOT_READY:
+			return false;
+		case VK_ERROR_OUT_OF_DATE_KHR:
+			output->swapchain_stale = true;
+			return false;
+		case VK_ERROR_SURFACE_LOST_KHR:
+			vk_output_lose(output);
+			return false;
+		default:
+			panic("Unexpected error when acquiring next swapchain image");
+	}
+	// Everything recorded into the slot's pool last time has finished, so it is recycled in one go
+	vkResetCommandPool(vk->device, inflight->command_pool, 0);
+	inflight->frame = ++output->frame_count;
+	output->current_inflight = next_inflight;
+	vk_output_image_prepare(vk, output, frame->image_index);
+	frame->output = output;
+	frame->inflight = inflight;
+	frame->command_buffer = inflight->command_buffer;
+	frame->framebuffer = output->framebuffers[frame->image_index];
+	frame->extent = output->swapchain_extent;
+	frame->layer_len = 0;
+	frame->recording = NULL;
+
+	VkCommandBufferBeginInfo vk_command_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+	};
+	if (vkBeginCommandBuffer(frame->command_buffer, &vk_command_begin_info) != VK_SUCCESS)
+		panic("Unable to start command buffer");
+	// The slot's previous timestamps are read under the lease in vk_frame_end, before this reset executes.
+	// The start is written at the latest stage the submission's waits hold back, so acquire and upload waits are not timed.
+	if (vk->profiler.enabled) {
+		vkCmdResetQueryPool(frame->command_buffer, inflight->query_pool, 0, VK_PROFILE_FRAME_QUERIES);
+		vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, inflight->query_pool, 0);
+	}
+
+	// Layers clear whatever they cover themselves, so this only shows where none do
+	VkClearValue vk_clear_values[] = {
+		{ { { 0.0f, 0.0f, 0.0f, 1.0f } } }
+	};
+	VkRenderPassBeginInfo vk_renderpass_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.renderPass = vk->renderpass,
+		.framebuffer = frame->framebuffer,
+		.renderArea = {
+			.offset = { 0, 0 },
+			.extent = frame->extent
+		},
+		.clearValueCount = 1,
+		.pClearValues = vk_clear_values,
+	};
+	vkCmdBeginRenderPass(frame->command_buffer, &vk_renderpass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	return true;
+}
+
+VkExtent2D vk_frame_extent(struct vk_frame* frame) {
+	return frame->extent;
+}
+
+bool vk_frame_end(Vulkan* vk, struct vk_frame* frame) {
+	// Layers replayed before an atlas reset may sample pages already handed to the deletion queue
+	bool complete = true;
+	uint32_t layer_len = 0;
+	for (uint32_t index = 0; index < frame->layer_len; index++)
+		if (frame->layer_recordings[index]->atlas_generation == vk->glyph_atlas.generation) {
+			frame->layers[layer_len] = frame->layers[index];
+			frame->layer_recordings[layer_len++] = frame->layer_recordings[index];
+		} else {
+			complete = false;
+		}
+	frame->layer_len = layer_len;
+	if (frame->layer_len > 0)
+		vkCmdExecuteCommands(frame->command_buffer, frame->layer_len, frame->layers);
+	vkCmdEndRenderPass(frame->command_buffer);
+	if (vk->profiler.enabled)
+		vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->inflight->query_pool, 1);
+
+	if (vk->headless.readback) {
+		VkBufferImageCopy vk_copy_info = {
+			.bufferOffset = 0,
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = 0,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.imageOffset = { 0, 0, 0 },
+			.imageExtent = {
+				.width = frame->extent.width,
+				.height = frame->extent.height,
+				.depth = 1
+			}
+		};
+		// The renderpass has already transitioned the image to TRANSFER_SRC_OPTIMAL
+		VkMemoryBarrier vk_barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+		};
+		vkCmdPipelineBarrier(frame->command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &vk_barrier, 0, NULL, 0, NULL);
+		vkCmdCopyImageToBuffer(frame->command_buffer, frame->output->swapchain_images[frame->image_index].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame->output->readback_buffers[frame->image_index], 1, &vk_copy_info);
+		vk_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vk_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(frame->command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &vk_barrier, 0, NULL, 0, NULL);
+		if (vk->profiler.enabled)
+			vkCmdWriteTimestamp(frame->command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->inflight->query_pool, 2);
+	}
+	if (vkEndCommandBuffer(frame->command_buffer) != VK_SUCCESS)
+		panic("Unable to complete command buffer");
+
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint64_t wait_values[2];
+	uint32_t wait_len = 0;
+	// Nothing acquires or presents headless images
+	if (!vk->headless.enabled) {
+		wait_semaphores[wait_len] = frame->inflight->render_semaphore;
+		wait_stages[wait_len] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_values[wait_len++] = 0;
+	}
+	// Only the uploads this frame samples are waited for, so unrelated copies keep running alongside it
+	uint64_t upload_value = 0;
+	for (uint32_t index = 0; index < frame->layer_len; index++)
+		if (frame->layer_recordings[index]->upload_value > upload_value)
+			upload_value = frame->layer_recordings[index]->upload_value;
+	if (vk->transfer.enabled && upload_value > 0) {
+		wait_semaphores[wait_len] = vk->transfer.timeline;
+		wait_stages[wait_len] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		wait_values[wait_len++] = upload_value;
+	}
+	VkTimelineSemaphoreSubmitInfoKHR vk_timeline_info = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.waitSemaphoreValueCount = wait_len,
+		.pWaitSemaphoreValues = wait_values
+	};
+	VkSubmitInfo vk_submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = vk->transfer.enabled ? &vk_timeline_info : NULL,
+		.waitSemaphoreCount = wait_len,
+		.pWaitSemaphores = wait_semaphores,
+		.pWaitDstStageMask = wait_stages,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &frame->command_buffer,
+		.signalSemaphoreCount = vk->headless.enabled ? 0 : 1,
+		.pSignalSemaphores = &frame->inflight->present_semaphore
+	};
+	// Reset under the lease, right before the submission, so the deletion queue can poll every slot's fence
+	vkResetFences(vk->device, 1, &frame->inflight->fence);
+	frame->inflight->submit_serial = ++vk->submit_serial;
+	vk_profile_frame_collect(vk, frame->inflight);
+	if (vkQueueSubmit(vk->queue, 1, &vk_submit_info, frame->inflight->fence) != VK_SUCCESS)
+		panic("Unable to submit render queue");
+	frame->inflight->profiled = vk->profiler.enabled;
+	vk_deletion_collect(vk, false);
+	if (vk->headless.enabled)
+		return complete;
+
+	VkPresentInfoKHR vk_present_info = {
+		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+		.waitSemaphoreCount = 1,
+		.pWaitSemaphores = &frame->inflight->present_semaphore,
+		.swapchainCount = 1,
+		.pSwapchains = &frame->output->swapchain,
+		.pImageIndices = &frame->image_index
+	};
+	switch (vkQueuePresentKHR(vk->queue, &vk_present_info)) {
+		case VK_SUCCESS:
+			break;
+		case VK_SUBOPTIMAL_KHR:
+		case VK_ERROR_OUT_OF_DATE_KHR:
+			frame->output->swapchain_stale = true;
+			break;
+		case VK_ERROR_SURFACE_LOST_KHR:
+			vk_output_lose(frame->output);
+			break;
+		default:
+			panic("Unable to present the swapchain");
+	}
+	return complete;
+}
+
+const uint8_t* vk_headless_readback(Vulkan* vk, Output* output) {
+	if (!vk->headless.readback)
+		return NULL;
+	InFlight* inflight = &output->inflight[output->current_inflight];
+	vkWaitForFences(vk->device, 1, &inflight->fence, VK_TRUE, UINT64_MAX);
+	// Image indices match in-flight slots
+	return output->readback_memory[output->current_inflight].mapped;
+}
+
 InFlight vk_inflight_setup(Vulkan* vk) {
 	InFlight inflight;
 
@@ -611,6 +2137,38 @@ InFlight vk_inflight_setup(Vulkan* vk) {
 	if (vkCreateFence(vk->device, &vk_fence_info, NULL, &inflight.fence) != VK_SUCCESS)
 		panic("Unable to create fence");
 
+	// Create the command pool, which is reset as a whole rather than buffer by buffer
+	VkCommandPoolCreateInfo vk_command_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = vk->queue_family,
+	};
+	if (vkCreateCommandPool(vk->device, &vk_command_pool_info, NULL, &inflight.command_pool) != VK_SUCCESS)
+		panic("Unable to create command pool");
+	VkCommandBufferAllocateInfo vk_command_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = inflight.command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1
+	};
+	if (vkAllocateCommandBuffers(vk->device, &vk_command_buffer_info, &inflight.command_buffer) != VK_SUCCESS)
+		panic("Unable to allocate command buffers");
+
+	inflight.query_pool = VK_NULL_HANDLE;
+	if (vk->profiler.enabled) {
+		VkQueryPoolCreateInfo vk_query_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = VK_PROFILE_FRAME_QUERIES
+		};
+		if (vkCreateQueryPool(vk->device, &vk_query_pool_info, NULL, &inflight.query_pool) != VK_SUCCESS)
+			panic("Unable to create timestamp query pool");
+	}
+
+	inflight.frame = 0;
+	inflight.submit_serial = 0;
+	inflight.profiled = false;
+
 	return inflight;
 }
 
@@ -618,94 +2176,366 @@ void vk_inflight_cleanup(Vulkan* vk, InFlight* inflight) {
 	vkDestroySemaphore(vk->device, inflight->render_semaphore, NULL);
 	vkDestroySemaphore(vk->device, inflight->present_semaphore, NULL);
 	vkDestroyFence(vk->device, inflight->fence, NULL);
+	vkDestroyCommandPool(vk->device, inflight->command_pool, NULL);
+	if (inflight->query_pool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(vk->device, inflight->query_pool, NULL);
 }
 
-struct vk_staging_buffer vk_staging_buffer_create(Vulkan* vk, void* data, size_t data_len) {
-	struct vk_staging_buffer staging;
+Layer* vk_layer_setup(Vulkan* vk, Output* output) {
+	Layer* layer = malloc(sizeof(Layer));
+	layer->output = output;
+	layer->current = 0;
 
+	// Buffers are reset individually when re-recorded, and kept while they are replayed
+	VkCommandPoolCreateInfo vk_command_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = vk->queue_family,
+	};
+	if (vkCreateCommandPool(vk->device, &vk_command_pool_info, NULL, &layer->command_pool) != VK_SUCCESS)
+		panic("Unable to create command pool");
+	VkCommandBufferAllocateInfo vk_command_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = layer->command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+		.commandBufferCount = 1
+	};
 	VkBufferCreateInfo vk_buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = staging.buffer_len = data_len,
-		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		.size = sizeof(struct vk_glyph_instance) * VK_MAX_GLYPH_INSTANCES,
+		.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 	};
-	if (vkCreateBuffer(vk->device, &vk_buffer_info, NULL, &staging.buffer) != VK_SUCCESS)
-		panic("Failed to create staging buffer");
-	vkGetBufferMemoryRequirements(vk->device, staging.buffer, &staging.memory_requirements);
+	for (uint32_t index = 0; index < VK_MAX_INFLIGHT; index++) {
+		struct vk_layer_recording* recording = &layer->recordings[index];
+		if (vkAllocateCommandBuffers(vk->device, &vk_command_buffer_info, &recording->command_buffer) != VK_SUCCESS)
+			panic("Unable to allocate command buffers");
+		if (vkCreateBuffer(vk->device, &vk_buffer_info, NULL, &recording->glyph_instance_buffer) != VK_SUCCESS)
+			panic("Failed to create glyph instance buffer");
+		recording->glyph_instance_memory = vk_memory_bind_buffer(vk, recording->glyph_instance_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		recording->glyph_instances = recording->glyph_instance_memory.mapped;
+		recording->glyph_instance_len = 0;
+		recording->recorded = false;
+		recording->last_frame = 0;
+		recording->upload_value = 0;
+	}
+	return layer;
+}
 
-	VkMemoryAllocateInfo vk_memory_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.memoryTypeIndex = vk_find_memory_type(vk, staging.memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-		.allocationSize = staging.memory_requirements.size
-	};
-	if (vkAllocateMemory(vk->device, &vk_memory_info, NULL, &staging.memory) != VK_SUCCESS)
-		panic("Unable to allocate memory for staging buffer");
-	vkBindBufferMemory(vk->device, staging.buffer, staging.memory, 0);
+void vk_layer_cleanup(Vulkan* vk, Layer* layer) {
+	for (uint32_t index = 0; index < VK_MAX_INFLIGHT; index++) {
+		struct vk_layer_recording* recording = &layer->recordings[index];
+		vk_output_frame_done(vk, layer->output, recording->last_frame, true);
+		vkDestroyBuffer(vk->device, recording->glyph_instance_buffer, NULL);
+		vk_memory_free(vk, &recording->glyph_instance_memory);
+	}
+	vkDestroyCommandPool(vk->device, layer->command_pool, NULL);
+	free(layer);
+}
+
+bool vk_layer_begin(Vulkan* vk, Layer* layer, struct vk_frame* frame, uint64_t serial, bool reusable, struct vk_frame* layer_frame) {
+	if (frame->layer_len == VK_MAX_FRAME_LAYERS)
+		panic("Too many layers in one frame");
+	uint64_t frame_number = frame->inflight->frame;
+	struct vk_layer_recording* recording = &layer->recordings[layer->current];
+	if (
+		reusable && recording->recorded && recording->serial == serial &&
+		recording->extent.width == frame->extent.width && recording->extent.height == frame->extent.height &&
+		recording->atlas_generation == vk->glyph_atlas.generation
+	) {
+		// Pending frames may still be executing it, which SIMULTANEOUS_USE allows
+		recording->last_frame = frame_number;
+		frame->layer_recordings[frame->layer_len] = recording;
+		frame->layers[frame->layer_len++] = recording->command_buffer;
+		return false;
+	}
 
-	void* staging_data;
-	vkMapMemory(vk->device, staging.memory, 0, data_len, 0, &staging_data);
-	memcpy(staging_data, data, data_len);
-	vkUnmapMemory(vk->device, staging.memory);
+	// Only VK_MAX_INFLIGHT - 1 earlier frames can be pending, so one recording is always idle
+	uint32_t next = (layer->current + 1) % VK_MAX_INFLIGHT;
+	for (uint32_t offset = 1; offset <= VK_MAX_INFLIGHT; offset++) {
+		uint32_t index = (layer->current + offset) % VK_MAX_INFLIGHT;
+		if (vk_output_frame_done(vk, layer->output, layer->recordings[index].last_frame, false)) {
+			next = index;
+			break;
+		}
+	}
+	vk_output_frame_done(vk, layer->output, layer->recordings[next].last_frame, true);
+	layer->current = next;
+	recording = &layer->recordings[next];
+	recording->serial = serial;
+	recording->extent = frame->extent;
+	recording->atlas_generation = vk->glyph_atlas.generation;
+	recording->recorded = false;
+	recording->last_frame = frame_number;
+	recording->glyph_instance_len = 0;
+	recording->upload_value = 0;
+
+	// No framebuffer is given, so the recording can be replayed into any swapchain image
+	VkCommandBufferInheritanceInfo vk_inheritance_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = vk->renderpass,
+		.subpass = 0,
+		.framebuffer = VK_NULL_HANDLE
+	};
+	VkCommandBufferBeginInfo vk_command_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+		.pInheritanceInfo = &vk_inheritance_info
+	};
+	if (vkBeginCommandBuffer(recording->command_buffer, &vk_command_begin_info) != VK_SUCCESS)
+		panic("Unable to start layer command buffer");
 
-	return staging;
+	VkDeviceSize instance_offset = 0;
+	vkCmdBindVertexBuffers(recording->command_buffer, 0, 1, &recording->glyph_instance_buffer, &instance_offset);
+	// Dynamic state is not inherited from the primary command buffer
+	VkViewport vk_viewport = {
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (float) frame->extent.width,
+		.height = (float) frame->extent.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	};
+	VkRect2D vk_scissor = {
+		.offset = { 0 },
+		.extent = frame->extent
+	};
+	vkCmdSetViewport(recording->command_buffer, 0, 1, &vk_viewport);
+	vkCmdSetScissor(recording->command_buffer, 0, 1, &vk_scissor);
+	// An orthographic projection over the whole extent, so text is drawn at native resolution
+	struct vk_viewport_transform transform = {
+		.scale = { 2.0f / frame->extent.width, 2.0f / frame->extent.height },
+		.offset = { -1.0f, -1.0f }
+	};
+	vkCmdPushConstants(recording->command_buffer, vk->glyph_pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(transform), &transform);
+	// Every texture is in the one set, so draws only push which to sample
+	if (vk->bindless.enabled)
+		vkCmdBindDescriptorSets(recording->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk->glyph_pipeline.layout, 0, 1, &vk->bindless.set, 0, NULL);
+
+	*layer_frame = *frame;
+	layer_frame->command_buffer = recording->command_buffer;
+	layer_frame->framebuffer = VK_NULL_HANDLE;
+	layer_frame->layer_len = 0;
+	layer_frame->recording = recording;
+	frame->layer_recordings[frame->layer_len] = recording;
+	frame->layers[frame->layer_len++] = recording->command_buffer;
+	return true;
 }
 
-void vk_staging_buffer_destroy(Vulkan* vk, struct vk_staging_buffer* staging) {
-	vkDestroyBuffer(vk->device, staging->buffer, NULL);
-	vkFreeMemory(vk->device, staging->memory, NULL);
+void vk_layer_end(Vulkan* vk, struct vk_frame* layer_frame) {
+	if (vkEndCommandBuffer(layer_frame->command_buffer) != VK_SUCCESS)
+		panic("Unable to complete layer command buffer");
+	layer_frame->recording->recorded = true;
 }
 
-VkCommandBuffer vk_staging_buffer_start_transfer(Vulkan* vk) {
-	VkCommandBuffer transfer_buffer;
+static void vk_upload_ring_setup(Vulkan* vk) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->submitted = 0;
+	ring->upload_first = 0;
+	ring->upload_len = 0;
+
+	VkBufferCreateInfo vk_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = VK_UPLOAD_RING_SIZE,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	if (vkCreateBuffer(vk->device, &vk_buffer_info, NULL, &ring->buffer) != VK_SUCCESS)
+		panic("Failed to create upload ring buffer");
+	ring->memory = vk_memory_bind_buffer(vk, ring->buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	ring->data = ring->memory.mapped;
+
 	VkCommandBufferAllocateInfo vk_command_buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
 		.commandPool = vk->command_pool,
 		.commandBufferCount = 1
 	};
-	if (vkAllocateCommandBuffers(vk->device, &vk_command_buffer_info, &transfer_buffer) != VK_SUCCESS)
-		panic("Unable to allocate staging transfer command buffer");
-	
+	VkFenceCreateInfo vk_fence_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
+	};
+	for (uint32_t index = 0; index < VK_MAX_UPLOADS; index++) {
+		if (vkAllocateCommandBuffers(vk->device, &vk_command_buffer_info, &ring->uploads[index].command_buffer) != VK_SUCCESS)
+			panic("Unable to allocate upload command buffer");
+		if (vkCreateFence(vk->device, &vk_fence_info, NULL, &ring->uploads[index].fence) != VK_SUCCESS)
+			panic("Unable to create upload fence");
+	}
+
+	if (vk->profiler.upload_mask) {
+		VkQueryPoolCreateInfo vk_query_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 2 * VK_MAX_UPLOADS
+		};
+		if (vkCreateQueryPool(vk->device, &vk_query_pool_info, NULL, &vk->profiler.upload_queries) != VK_SUCCESS)
+			panic("Unable to create upload timestamp query pool");
+		// Queries start out undefined, and slots are only reset again once they have been read
+		if (vk->profiler.host_reset)
+			vk->profiler.reset_query_pool(vk->device, vk->profiler.upload_queries, 0, 2 * VK_MAX_UPLOADS);
+	}
+}
+
+static void vk_upload_ring_cleanup(Vulkan* vk) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	for (uint32_t index = 0; index < VK_MAX_UPLOADS; index++) {
+		vkFreeCommandBuffers(vk->device, vk->command_pool, 1, &ring->uploads[index].command_buffer);
+		vkDestroyFence(vk->device, ring->uploads[index].fence, NULL);
+	}
+	vkDestroyBuffer(vk->device, ring->buffer, NULL);
+	vk_memory_free(vk, &ring->memory);
+	if (vk->profiler.upload_mask)
+		vkDestroyQueryPool(vk->device, vk->profiler.upload_queries, NULL);
+}
+
+/// Reclaims the space of completed transfers, oldest first. Returns false if `wait` is not set and nothing had completed.
+static bool vk_upload_ring_retire(Vulkan* vk, bool wait) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	bool retired = false;
+	while (ring->upload_len > 0) {
+		struct vk_upload* upload = &ring->uploads[ring->upload_first];
+		if (wait && !retired)
+			vkWaitForFences(vk->device, 1, &upload->fence, VK_TRUE, UINT64_MAX);
+		else if (vkGetFenceStatus(vk->device, upload->fence) != VK_SUCCESS)
+			break;
+		vkResetFences(vk->device, 1, &upload->fence);
+		if (vk->profiler.upload_mask) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(vk->device, vk->profiler.upload_queries, 2 * ring->upload_first, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+				vk_profile_sample(vk, VK_PROFILE_UPLOAD, timestamps[0], timestamps[1], vk->profiler.upload_mask);
+			// The fence shows the slot's transfer is done with it, so it is reset for the next upload in it
+			if (vk->profiler.host_reset)
+				vk->profiler.reset_query_pool(vk->device, vk->profiler.upload_queries, 2 * ring->upload_first, 2);
+		}
+		ring->tail = upload->end;
+		vk->transfer.completed = upload->value;
+		ring->upload_first = (ring->upload_first + 1) % VK_MAX_UPLOADS;
+		ring->upload_len--;
+		retired = true;
+	}
+	return retired;
+}
+
+/// Where the next region of the given length starts
+static uint64_t vk_upload_ring_start(struct vk_upload_ring* ring, size_t data_len) {
+	uint64_t start = (ring->head + VK_UPLOAD_ALIGNMENT - 1) & ~(uint64_t)(VK_UPLOAD_ALIGNMENT - 1);
+	// Regions never wrap, so skip to the start of the ring when the end is too short
+	if (start % VK_UPLOAD_RING_SIZE + data_len > VK_UPLOAD_RING_SIZE)
+		start += VK_UPLOAD_RING_SIZE - start % VK_UPLOAD_RING_SIZE;
+	return start;
+}
+
+bool vk_staging_buffer_fits(Vulkan* vk, size_t data_len) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	return vk_upload_ring_start(ring, data_len) + data_len - ring->submitted <= VK_UPLOAD_RING_SIZE;
+}
+
+struct vk_staging_buffer vk_staging_buffer_create(Vulkan* vk, void* data, size_t data_len) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	if (data_len > VK_UPLOAD_RING_SIZE)
+		panic("Upload is larger than the upload ring");
+	vk_upload_ring_retire(vk, false);
+
+	uint64_t start;
+	while (true) {
+		start = vk_upload_ring_start(ring, data_len);
+		if (start + data_len - ring->tail <= VK_UPLOAD_RING_SIZE)
+			break;
+		// Only the regions of submitted transfers can be waited on
+		if (!vk_upload_ring_retire(vk, true))
+			panic("Upload ring exhausted by a transfer that has not been submitted, see vk_staging_buffer_fits");
+	}
+	ring->head = start + data_len;
+
+	struct vk_staging_buffer staging = {
+		.buffer = ring->buffer,
+		.offset = start % VK_UPLOAD_RING_SIZE,
+		.buffer_len = data_len
+	};
+	memcpy(ring->data + staging.offset, data, data_len);
+	return staging;
+}
+
+VkCommandBuffer vk_staging_buffer_start_transfer(Vulkan* vk) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	if (ring->upload_len == VK_MAX_UPLOADS)
+		vk_upload_ring_retire(vk, true);
+
+	uint32_t upload_index = (ring->upload_first + ring->upload_len) % VK_MAX_UPLOADS;
+	VkCommandBuffer transfer_buffer = ring->uploads[upload_index].command_buffer;
 	VkCommandBufferBeginInfo vk_transfer_begin_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
 	};
 	if (vkBeginCommandBuffer(transfer_buffer, &vk_transfer_begin_info) != VK_SUCCESS)
 		panic("Unable to begin transfer command buffer");
+	if (vk->profiler.upload_mask) {
+		if (!vk->profiler.host_reset)
+			vkCmdResetQueryPool(transfer_buffer, vk->profiler.upload_queries, 2 * upload_index, 2);
+		vkCmdWriteTimestamp(transfer_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vk->profiler.upload_queries, 2 * upload_index);
+	}
 	return transfer_buffer;
 }
 
+static void vk_glyph_atlas_end_transfer(Vulkan*, VkCommandBuffer);
+
 void vk_staging_buffer_end_transfer(Vulkan* vk, VkCommandBuffer transfer_buffer) {
+	struct vk_upload_ring* ring = &vk->upload_ring;
+	struct vk_upload* upload = &ring->uploads[(ring->upload_first + ring->upload_len) % VK_MAX_UPLOADS];
+
+	vk_glyph_atlas_end_transfer(vk, transfer_buffer);
+	if (vk->profiler.upload_mask)
+		vkCmdWriteTimestamp(transfer_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk->profiler.upload_queries, 2 * (upload - ring->uploads));
 	vkEndCommandBuffer(transfer_buffer);
+	// Pages record the value this transfer signals as they are written
+	uint64_t signal_value = vk->transfer.value + 1;
+	VkTimelineSemaphoreSubmitInfoKHR vk_timeline_info = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.signalSemaphoreValueCount = 1,
+		.pSignalSemaphoreValues = &signal_value
+	};
 	VkSubmitInfo vk_sumbit_info = {
 		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = vk->transfer.enabled ? &vk_timeline_info : NULL,
 		.commandBufferCount = 1,
 		.pCommandBuffers = &transfer_buffer,
+		.signalSemaphoreCount = vk->transfer.enabled ? 1 : 0,
+		.pSignalSemaphores = &vk->transfer.timeline
 	};
-	if (vkQueueSubmit(vk->queue, 1, &vk_sumbit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+	if (vkQueueSubmit(vk->transfer.queue, 1, &vk_sumbit_info, upload->fence) != VK_SUCCESS)
 		panic("Unable to submit staging buffer transfer commands");
-	vkQueueWaitIdle(vk->queue);
-	vkFreeCommandBuffers(vk->device, vk->command_pool, 1, &transfer_buffer);
+	vk->transfer.value = signal_value;
+	upload->value = signal_value;
+	// Every region allocated so far is read by this transfer
+	upload->end = ring->head;
+	ring->submitted = ring->head;
+	ring->upload_len++;
 }
 
-struct vk_glyph vk_create_glyph(Vulkan* vk, struct vk_staging_buffer* staging, VkCommandBuffer transfer_buffer, uint32_t width, uint32_t height) {
-	struct vk_glyph glyph;
+/// The layout pages are sampled in. Pages written on a transfer-only queue stay in GENERAL, as a layout transition there
+/// could not be ordered against frames still sampling the page.
+static VkImageLayout vk_glyph_atlas_sampled_layout(Vulkan* vk) {
+	return vk->transfer.enabled ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
 
-	VkDescriptorSetAllocateInfo vk_glyph_descriptor_sets_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = vk->glyph_pipeline.descriptor_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &vk->glyph_pipeline.descriptor_layout
-	};
-	if (vkAllocateDescriptorSets(vk->device, &vk_glyph_descriptor_sets_info, &glyph.descriptor) != VK_SUCCESS)
-		panic("Unable to allocate glyph descriptor sets");
-	
-	VkImageCreateInfo vk_buffer_info = {
+/// Creates an empty atlas page, recording its zeroing into the transfer buffer
+static void vk_glyph_atlas_add_page(Vulkan* vk, VkCommandBuffer transfer_buffer) {
+	struct vk_glyph_atlas* atlas = &vk->glyph_atlas;
+	atlas->pages = realloc(atlas->pages, sizeof(struct vk_glyph_atlas_page) * (atlas->page_len + 1));
+	struct vk_glyph_atlas_page* page = &atlas->pages[atlas->page_len++];
+	page->shelves = NULL;
+	page->shelf_len = 0;
+	page->shelf_end = 0;
+	page->upload_value = vk->transfer.value + 1;
+
+	uint32_t queue_families[] = { vk->queue_family, vk->transfer.queue_family };
+	VkImageCreateInfo vk_image_info = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 		.imageType = VK_IMAGE_TYPE_2D,
 		.extent = {
-				.width = width,
-				.height = height,
+				.width = VK_GLYPH_ATLAS_SIZE,
+				.height = VK_GLYPH_ATLAS_SIZE,
 				.depth = 1
 			},
 		.mipLevels = 1,
@@ -715,42 +2545,180 @@ struct vk_glyph vk_create_glyph(Vulkan* vk, struct vk_staging_buffer* staging, V
 		.tiling = VK_IMAGE_TILING_OPTIMAL,
 		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		// Shared by both queues rather than transferring ownership after every upload
+		.sharingMode = vk->transfer.enabled ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = vk->transfer.enabled ? 2 : 0,
+		.pQueueFamilyIndices = queue_families
 	};
-	if (vkCreateImage(vk->device, &vk_buffer_info, NULL, &glyph.image) != VK_SUCCESS)
-		panic("Failed to create glyph image");
-	vkGetImageMemoryRequirements(vk->device, glyph.image, &glyph.memory_requirements);
+	if (vkCreateImage(vk->device, &vk_image_info, NULL, &page->image) != VK_SUCCESS)
+		panic("Failed to create glyph atlas image");
+	page->memory = vk_memory_bind_image(vk, page->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	VkMemoryAllocateInfo vk_memory_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.memoryTypeIndex = vk_find_memory_type(vk, glyph.memory_requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
-		.allocationSize = glyph.memory_requirements.size
+	VkImageViewCreateInfo vk_view_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = page->image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = VK_FORMAT_R8_SRGB,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+			.baseMipLevel = 0,
+			.levelCount = 1
+		}
 	};
-	if (vkAllocateMemory(vk->device, &vk_memory_info, NULL, &glyph.memory) != VK_SUCCESS)
-		panic("Unable to allocate memory for staging buffer");
-	vkBindImageMemory(vk->device, glyph.image, glyph.memory, 0);
+	if (vkCreateImageView(vk->device, &vk_view_info, NULL, &page->view) != VK_SUCCESS)
+		panic("Unable to create glyph atlas image view");
+
+	if (vk->bindless.enabled) {
+		page->descriptor = VK_NULL_HANDLE;
+		page->texture = vk_bindless_texture_add(vk, page->view, vk_glyph_atlas_sampled_layout(vk));
+	} else {
+		page->descriptor = vk_descriptor_alloc(vk, &vk->glyph_pipeline.descriptors);
+		// The sampler is immutable, so only the view is written
+		VkDescriptorImageInfo vk_glyph_image_info = {
+			.imageView = page->view,
+			.sampler = VK_NULL_HANDLE,
+			.imageLayout = vk_glyph_atlas_sampled_layout(vk)
+		};
+		VkWriteDescriptorSet vk_glyph_write = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = page->descriptor,
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.pImageInfo = &vk_glyph_image_info
+		};
+		vkUpdateDescriptorSets(vk->device, 1, &vk_glyph_write, 0, NULL);
+	}
 
+	// Zero the page so the padding between glyphs samples as transparent. It is copied from the zero buffer rather than
+	// cleared, as transfer-only queues cannot record vkCmdClearColorImage.
+	VkImageSubresourceRange vk_page_range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1
+	};
+	page->layout = vk->transfer.enabled ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 	VkImageMemoryBarrier transfer_barrier = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = page->layout,
 		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.image = glyph.image,
-		.subresourceRange = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		},
+		.image = page->image,
+		.subresourceRange = vk_page_range,
 		.srcAccessMask = 0,
 		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
 	};
 	vkCmdPipelineBarrier(transfer_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &transfer_barrier);
+	VkBufferImageCopy vk_zero_copies[VK_GLYPH_ATLAS_SIZE / VK_GLYPH_ATLAS_ZERO_ROWS];
+	for (uint32_t index = 0; index < VK_GLYPH_ATLAS_SIZE / VK_GLYPH_ATLAS_ZERO_ROWS; index++)
+		vk_zero_copies[index] = (VkBufferImageCopy){
+			.bufferOffset = 0,
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = 0,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.imageOffset = { 0, index * VK_GLYPH_ATLAS_ZERO_ROWS, 0 },
+			.imageExtent = { VK_GLYPH_ATLAS_SIZE, VK_GLYPH_ATLAS_ZERO_ROWS, 1 }
+		};
+	vkCmdCopyBufferToImage(transfer_buffer, vk->glyph_atlas.zero_buffer, page->image, page->layout, VK_GLYPH_ATLAS_SIZE / VK_GLYPH_ATLAS_ZERO_ROWS, vk_zero_copies);
+	// Glyphs are copied over the zeroed texels
+	VkMemoryBarrier vk_clear_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+	};
+	vkCmdPipelineBarrier(transfer_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &vk_clear_barrier, 0, NULL, 0, NULL);
+}
+
+/// Finds space for a padded glyph in a page, returning false if it does not fit
+static bool vk_glyph_atlas_page_pack(struct vk_glyph_atlas_page* page, uint32_t width, uint32_t height, uint32_t* x, uint32_t* y) {
+	// Best fit among the shelves tall enough, ignoring shelves that would waste over a third of their height
+	struct vk_glyph_atlas_shelf* best = NULL;
+	for (uint32_t index = 0; index < page->shelf_len; index++) {
+		struct vk_glyph_atlas_shelf* shelf = &page->shelves[index];
+		if (shelf->height < height || shelf->height * 2 > height * 3 || shelf->x + width > VK_GLYPH_ATLAS_SIZE)
+			continue;
+		if (!best || shelf->height < best->height)
+			best = shelf;
+	}
+
+	if (!best) {
+		if (page->shelf_end + height > VK_GLYPH_ATLAS_SIZE)
+			return false;
+		page->shelves = realloc(page->shelves, sizeof(struct vk_glyph_atlas_shelf) * (page->shelf_len + 1));
+		best = &page->shelves[page->shelf_len++];
+		best->y = page->shelf_end;
+		best->height = height;
+		best->x = 0;
+		page->shelf_end += height;
+	}
+
+	*x = best->x;
+	*y = best->y;
+	best->x += width;
+	return true;
+}
+
+struct vk_glyph vk_glyph_atlas_insert(Vulkan* vk, struct vk_staging_buffer* staging, VkCommandBuffer transfer_buffer, uint32_t width, uint32_t height) {
+	struct vk_glyph_atlas* atlas = &vk->glyph_atlas;
+	struct vk_glyph glyph = { 0 };
+	// Whitespace has nothing to sample
+	if (width == 0 || height == 0)
+		return glyph;
+
+	uint32_t padded_width = width + VK_GLYPH_ATLAS_PADDING;
+	uint32_t padded_height = height + VK_GLYPH_ATLAS_PADDING;
+	if (padded_width > VK_GLYPH_ATLAS_SIZE || padded_height > VK_GLYPH_ATLAS_SIZE)
+		panic("Glyph is larger than a glyph atlas page");
+
+	uint32_t x, y;
+	glyph.page = 0;
+	while (glyph.page < atlas->page_len && !vk_glyph_atlas_page_pack(&atlas->pages[glyph.page], padded_width, padded_height, &x, &y))
+		glyph.page++;
+	// Grow the atlas when every page is full
+	if (glyph.page == atlas->page_len) {
+		vk_glyph_atlas_add_page(vk, transfer_buffer);
+		vk_glyph_atlas_page_pack(&atlas->pages[glyph.page], padded_width, padded_height, &x, &y);
+	}
+	struct vk_glyph_atlas_page* page = &atlas->pages[glyph.page];
+
+	// Uploads are batched, so the page only needs to be made writable once per transfer.
+	// Pages written on a transfer-only queue are never transitioned, as only new texels are written.
+	page->upload_value = vk->transfer.value + 1;
+	if (page->layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		VkImageMemoryBarrier transfer_barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.oldLayout = page->layout,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = page->image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		};
+		vkCmdPipelineBarrier(transfer_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &transfer_barrier);
+		page->layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	}
 
 	VkBufferImageCopy vk_copy_info = {
-		.bufferOffset = 0,
+		.bufferOffset = staging->offset,
 		.bufferRowLength = 0,
 		.bufferImageHeight = 0,
 		.imageSubresource = {
@@ -759,98 +2727,95 @@ struct vk_glyph vk_create_glyph(Vulkan* vk, struct vk_staging_buffer* staging, V
 			.baseArrayLayer = 0,
 			.layerCount = 1
 		},
-		.imageOffset = { 0, 0, 0 },
+		.imageOffset = { x, y, 0 },
 		.imageExtent = { width, height, 1 }
 	};
-	vkCmdCopyBufferToImage(transfer_buffer, staging->buffer, glyph.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &vk_copy_info);
-	
-	VkImageMemoryBarrier render_barrier = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.image = glyph.image,
-		.subresourceRange = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1
-		},
-		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-	};
-	vkCmdPipelineBarrier(transfer_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &render_barrier);
-
-	VkImageViewCreateInfo vk_view_info = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-		.image = glyph.image,
-		.viewType = VK_IMAGE_VIEW_TYPE_2D,
-		.format = VK_FORMAT_R8_SRGB,
-		.subresourceRange = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseArrayLayer = 0,
-			.layerCount = 1,
-			.baseMipLevel = 0,
-			.levelCount = 1
-		}
-	};
-	if (vkCreateImageView(vk->device, &vk_view_info, NULL, &glyph.view) != VK_SUCCESS)
-		panic("Unable to create glyph image view");
-	
-	VkSamplerCreateInfo vk_sampler_info = {
-		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-		.magFilter = VK_FILTER_LINEAR,
-		.minFilter = VK_FILTER_LINEAR,
-		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
-		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
-		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER,
-		.anisotropyEnable = VK_TRUE,
-		.maxAnisotropy = 16.0f,
-		.borderColor = VK_BORDER_COLOR_INT_TRANSPARENT_BLACK,
-		.unnormalizedCoordinates = VK_FALSE,
-		.compareEnable = VK_FALSE,
-		.compareOp = VK_COMPARE_OP_ALWAYS,
-		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-		.mipLodBias = 0.0f,
-		.minLod = 0.0f,
-		.maxLod = 0.0f,
-	};
-	if (vkCreateSampler(vk->device, &vk_sampler_info, NULL, &glyph.sampler) != VK_SUCCESS)
-		panic("Unable to create glyph sampler");
+	vkCmdCopyBufferToImage(transfer_buffer, staging->buffer, page->image, page->layout, 1, &vk_copy_info);
 
-	VkDescriptorImageInfo vk_glyph_image_info = {
-		.imageView = glyph.view,
-		.sampler = glyph.sampler,
-		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
-	};
-	VkWriteDescriptorSet vk_glyph_write = {
-		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-		.dstSet = glyph.descriptor,
-		.dstBinding = 0,
-		.dstArrayElement = 0,
-		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = 1,
-		.pImageInfo = &vk_glyph_image_info
-	};
-	vkUpdateDescriptorSets(vk->device, 1, &vk_glyph_write, 0, NULL);
-	
+	glyph.u = (float)x / VK_GLYPH_ATLAS_SIZE;
+	glyph.v = (float)y / VK_GLYPH_ATLAS_SIZE;
+	glyph.uv_width = (float)width / VK_GLYPH_ATLAS_SIZE;
+	glyph.uv_height = (float)height / VK_GLYPH_ATLAS_SIZE;
 	return glyph;
 }
 
-void vk_destroy_glyph(Vulkan* vk, struct vk_glyph* glyph) {
-	//vkFreeDescriptorSets(vk->device, vk->glyph_pipeline.descriptor_pool, 1, &glyph->descriptor);
-	vkDestroySampler(vk->device, glyph->sampler, NULL);
-	vkDestroyImageView(vk->device, glyph->view, NULL);
-	vkDestroyImage(vk->device, glyph->image, NULL);
-	vkFreeMemory(vk->device, glyph->memory, NULL);
+/// Makes every page written during a transfer readable by the glyph shader again
+static void vk_glyph_atlas_end_transfer(Vulkan* vk, VkCommandBuffer transfer_buffer) {
+	for (uint32_t index = 0; index < vk->glyph_atlas.page_len; index++) {
+		struct vk_glyph_atlas_page* page = &vk->glyph_atlas.pages[index];
+		if (page->layout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+			continue;
+		VkImageMemoryBarrier render_barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = page->image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+		};
+		vkCmdPipelineBarrier(transfer_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &render_barrier);
+		page->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
 }
 
-void vk_draw_glyph(Vulkan* vk, struct vk_glyph* glyph, struct vk_glyph_push_constant glyph_push_constant, uint32_t image_index) {
-	vkCmdBindDescriptorSets(vk->command_buffers[image_index], VK_PIPELINE_BIND_POINT_GRAPHICS, vk->glyph_pipeline.layout, 0, 1, &glyph->descriptor, 0, NULL);
-
-	vkCmdPushConstants(vk->command_buffers[image_index], vk->glyph_pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(struct vk_glyph_push_constant), &glyph_push_constant);
+void vk_glyph_atlas_reset(Vulkan* vk) {
+	struct vk_glyph_atlas* atlas = &vk->glyph_atlas;
+	// Blocks emptied by earlier resets go back to the driver. Those of the pages released here stay for reuse until the next.
+	vk_memory_defragment(vk);
+	// Pages may still be sampled by frames in flight, so they go once those complete
+	for (uint32_t index = 0; index < atlas->page_len; index++) {
+		struct vk_glyph_atlas_page* page = &atlas->pages[index];
+		if (vk->bindless.enabled)
+			vk_defer_deletion(vk, (struct vk_deletion){ .type = VK_DELETION_BINDLESS_TEXTURE, .texture = page->texture });
+		else
+			vk_defer_deletion(vk, (struct vk_deletion){
+				.type = VK_DELETION_DESCRIPTOR,
+				.descriptor = { .allocator = &vk->glyph_pipeline.descriptors, .set = page->descriptor }
+			});
+		vk_defer_deletion(vk, (struct vk_deletion){ .type = VK_DELETION_IMAGE_VIEW, .view = page->view });
+		vk_defer_deletion(vk, (struct vk_deletion){ .type = VK_DELETION_IMAGE, .image = page->image });
+		vk_defer_deletion(vk, (struct vk_deletion){ .type = VK_DELETION_MEMORY, .memory = page->memory });
+		free(page->shelves);
+	}
+	free(atlas->pages);
+	atlas->pages = NULL;
+	atlas->page_len = 0;
+	// Recordings of an older generation are never replayed or executed again
+	atlas->generation++;
+}
 
-	vkCmdDraw(vk->command_buffers[image_index], 6, 1, 0, 0);
+void vk_draw_glyphs(Vulkan* vk, struct vk_frame* frame, uint32_t page, const struct vk_glyph_instance* instances, uint32_t instance_len) {
+	struct vk_layer_recording* recording = frame->recording;
+	if (recording->glyph_instance_len + instance_len > VK_MAX_GLYPH_INSTANCES) {
+		// Every session draws from its own thread
+		static atomic_bool warned = false;
+		if (!atomic_exchange(&warned, true))
+			fprintf(stderr, "Glyphs: a layer drew more than %u glyphs, dropping the rest\n", VK_MAX_GLYPH_INSTANCES);
+		instance_len = VK_MAX_GLYPH_INSTANCES - recording->glyph_instance_len;
+	}
+	if (instance_len == 0)
+		return;
+
+	// The recording is idle while being recorded again, so nothing still reads these instances
+	uint32_t first_instance = recording->glyph_instance_len;
+	memcpy(&recording->glyph_instances[first_instance], instances, sizeof(struct vk_glyph_instance) * instance_len);
+	recording->glyph_instance_len += instance_len;
+
+	struct vk_glyph_atlas_page* atlas_page = &vk->glyph_atlas.pages[page];
+	if (atlas_page->upload_value > recording->upload_value)
+		recording->upload_value = atlas_page->upload_value;
+	if (vk->bindless.enabled)
+		vkCmdPushConstants(frame->command_buffer, vk->glyph_pipeline.layout, VK_SHADER_STAGE_FRAGMENT_BIT, VK_BINDLESS_TEXTURE_OFFSET, sizeof(uint32_t), &atlas_page->texture);
+	else
+		vkCmdBindDescriptorSets(frame->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vk->glyph_pipeline.layout, 0, 1, &atlas_page->descriptor, 0, NULL);
+	vkCmdDraw(frame->command_buffer, 6, instance_len, 0, first_instance);
 }
\ No newline at end of file
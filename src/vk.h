@@ -3,7 +3,9 @@
 
 #include <vulkan/vulkan.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <time.h>
 
 /// An image with a view
 typedef struct {
@@ -11,6 +13,41 @@ typedef struct {
 	VkImageView view;
 } Image;
 
+/// The number of sets in the first descriptor pool, each chained pool holding twice as many as the last
+#define VK_DESCRIPTOR_POOL_MIN_SETS 64
+
+/// Descriptor sets of a single layout with one binding, allocated from a chain of pools that grows on demand
+struct vk_descriptor_allocator {
+	VkDescriptorSetLayout layout;
+	VkDescriptorType type;
+	VkDescriptorPool* pools;
+	uint32_t pool_len;
+	/// Sets that may still be allocated from the last pool
+	uint32_t pool_available;
+	/// Sets given back by vk_descriptor_free, handed out again before a pool is touched
+	VkDescriptorSet* free_sets;
+	uint32_t free_len;
+};
+
+/// The longest bindless texture array, further limited by the device
+#define VK_BINDLESS_MAX_TEXTURES 4096
+
+/// A single descriptor set holding every sampled texture, used instead of a set per texture when the device
+/// supports descriptor indexing. Draws select their texture with a push constant, so each layer binds descriptors once.
+struct vk_bindless {
+	bool enabled;
+	/// An immutable sampler at binding 0 and a partially bound array of sampled images at binding 1
+	VkDescriptorSetLayout layout;
+	VkDescriptorPool pool;
+	VkDescriptorSet set;
+	/// The length of the texture array
+	uint32_t texture_max;
+	/// Elements handed out so far, below which removed elements are reused first
+	uint32_t texture_len;
+	uint32_t* free_textures;
+	uint32_t free_len;
+};
+
 struct vk_glyph_pipeline {
 	VkPipelineLayout layout;
 	VkPipeline pipeline;
@@ -18,96 +55,575 @@ struct vk_glyph_pipeline {
 	VkShaderModule vert_shader;
 	VkShaderModule frag_shader;
 
+	/// Samples through the atlas' immutable sampler, so sets only hold an image view
 	VkDescriptorSetLayout descriptor_layout;
-	VkDescriptorPool descriptor_pool;
+	struct vk_descriptor_allocator descriptors;
+};
+
+/// The log2 size of a memory block, which buddies are split from
+#define VK_MEMORY_BLOCK_ORDER 24
+/// The log2 size of the smallest buddy
+#define VK_MEMORY_MIN_ORDER 8
+/// Allocations larger than this are given a block of their own
+#define VK_MEMORY_DEDICATED_SIZE (1 << (VK_MEMORY_BLOCK_ORDER - 1))
+
+/// A single vkAllocateMemory, sub-allocated as a binary buddy tree
+struct vk_memory_block {
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	/// Mapped for the lifetime of the block if the memory is host visible, otherwise NULL
+	uint8_t* mapped;
+	/// For every tree node, one more than the relative order of its largest free buddy, or 0 if none is free.
+	/// NULL for dedicated blocks.
+	uint8_t* longest;
+	uint32_t allocation_len;
+};
+
+/// Blocks of one memory type holding only linear or only non-linear resources,
+/// so neighbouring allocations never break bufferImageGranularity
+struct vk_memory_pool {
+	struct vk_memory_block** blocks;
+	uint32_t block_len;
+};
+
+struct vk_allocator {
+	struct vk_memory_pool pools[VK_MAX_MEMORY_TYPES][2];
+};
+
+/// A sub-allocation of device memory
+struct vk_allocation {
+	VkDeviceMemory memory;
+	VkDeviceSize offset;
+	/// Host pointer to the allocation if its memory is host visible, otherwise NULL
+	void* mapped;
+	struct vk_memory_block* block;
+	uint32_t order;
+};
+
+/// The width and height of each glyph atlas page in texels
+#define VK_GLYPH_ATLAS_SIZE 1024
+/// Texels left empty around each glyph so linear filtering never samples a neighbour
+#define VK_GLYPH_ATLAS_PADDING 1
+/// Rows of a new page zeroed by each copy from the atlas's zero buffer
+#define VK_GLYPH_ATLAS_ZERO_ROWS 64
+
+/// A row of glyphs of similar height
+struct vk_glyph_atlas_shelf {
+	uint32_t y;
+	uint32_t height;
+	/// The next free column
+	uint32_t x;
+};
+
+/// One R8 texture that glyphs are packed into
+struct vk_glyph_atlas_page {
+	VkImage image;
+	struct vk_allocation memory;
+	VkImageView view;
+	/// Only used without bindless textures
+	VkDescriptorSet descriptor;
+	/// The page's element of the bindless texture array, when enabled
+	uint32_t texture;
+	/// The layout the image will be in once recorded commands complete
+	VkImageLayout layout;
+	/// The transfer timeline value once the page's last upload is complete
+	uint64_t upload_value;
+
+	struct vk_glyph_atlas_shelf* shelves;
+	uint32_t shelf_len;
+	/// The top of the free space below the last shelf
+	uint32_t shelf_end;
+};
+
+struct vk_glyph_atlas {
+	/// Baked into the glyph descriptor layout as an immutable sampler
+	VkSampler sampler;
+	/// Zeroed rows copied over new pages, as transfer-only queues cannot clear images
+	VkBuffer zero_buffer;
+	struct vk_allocation zero_memory;
+	struct vk_glyph_atlas_page* pages;
+	uint32_t page_len;
+	/// Bumped by vk_glyph_atlas_reset, which invalidates layers recorded against the old pages
+	uint64_t generation;
+};
+
+/// Push constant mapping pixel coordinates to clip space for the frame's extent, read by basic.vert.
+/// One pipeline serves outputs of every size.
+struct vk_viewport_transform {
+	float scale[2];
+	float offset[2];
+};
+/// With bindless textures, draws push the element of the texture array to sample after the transform, read by basic_bindless.frag
+#define VK_BINDLESS_TEXTURE_OFFSET sizeof(struct vk_viewport_transform)
+
+/// Per-glyph vertex input, read once per instance by basic.vert
+struct vk_glyph_instance {
+	float x;
+	float y;
+	float width;
+	float height;
+	/// The glyph's rectangle within its atlas page
+	float u;
+	float v;
+	float uv_width;
+	float uv_height;
+	float colour[4];
+};
+
+/// The size in bytes of the persistently mapped upload ring
+#define VK_UPLOAD_RING_SIZE (4 * 1024 * 1024)
+/// Ring offsets are aligned to a multiple of every texel size that may be copied from them
+#define VK_UPLOAD_ALIGNMENT 16
+/// The maximum number of transfers submitted but not yet known to have completed
+#define VK_MAX_UPLOADS 8
+
+/// A submitted transfer and the ring space it keeps alive until its fence signals
+struct vk_upload {
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	/// The ring position up to which this transfer's data extends
+	uint64_t end;
+	/// The transfer value it signals, see struct vk_transfer
+	uint64_t value;
+};
+
+/// Staging memory for every upload, sub-allocated in order and reclaimed as transfers retire
+struct vk_upload_ring {
+	VkBuffer buffer;
+	struct vk_allocation memory;
+	uint8_t* data;
+	/// Monotonic positions, wrapped to offsets modulo VK_UPLOAD_RING_SIZE.
+	/// Everything from tail up to head may still be read by the GPU.
+	uint64_t head;
+	uint64_t tail;
+	/// The head when the last transfer was submitted. Regions past it are only reclaimed after another submission.
+	uint64_t submitted;
+
+	/// Transfers in submission order, starting at upload_first and wrapping
+	struct vk_upload uploads[VK_MAX_UPLOADS];
+	uint32_t upload_first;
+	uint32_t upload_len;
+};
+
+/// Where uploads are submitted. A transfer-only queue is used when the device has one and supports timeline semaphores,
+/// so copies run alongside rendering. Otherwise uploads share the graphics queue and are ordered by barriers.
+struct vk_transfer {
+	bool enabled;
+	uint32_t queue_family;
+	VkQueue queue;
+	/// Each upload signals the next value, which frames wait for before sampling anything it wrote
+	VkSemaphore timeline;
+	/// The value signalled by the last submitted upload
+	uint64_t value;
+	/// The value of the last upload whose fence has been seen to signal
+	uint64_t completed;
+};
+
+/// Kinds of resource the deletion queue can release
+enum vk_deletion_type {
+	VK_DELETION_IMAGE,
+	VK_DELETION_IMAGE_VIEW,
+	VK_DELETION_BUFFER,
+	VK_DELETION_MEMORY,
+	VK_DELETION_DESCRIPTOR,
+	VK_DELETION_BINDLESS_TEXTURE
+};
+
+/// A resource that submitted work may still use, released by vk_deletion_collect once that work completes
+struct vk_deletion {
+	enum vk_deletion_type type;
+	union {
+		VkImage image;
+		VkImageView view;
+		VkBuffer buffer;
+		struct vk_allocation memory;
+		struct {
+			struct vk_descriptor_allocator* allocator;
+			VkDescriptorSet set;
+		} descriptor;
+		uint32_t texture;
+	};
+	/// Graphics submissions up to this serial and uploads up to this transfer value may still use the resource
+	uint64_t submit_serial;
+	uint64_t upload_value;
+};
+
+/// Deletions in the order they were deferred, which is also the order they become safe in
+struct vk_deletion_queue {
+	struct vk_deletion* deletions;
+	uint32_t len;
+	uint32_t capacity;
+};
+
+/// GPU work timed with timestamp queries when WAYVK_PROFILE is set
+enum vk_profile_stage {
+	/// The clear and every layer of a frame, as layers are executed within one subpass
+	VK_PROFILE_RENDER_PASS,
+	/// Copying a headless frame into host memory
+	VK_PROFILE_READBACK,
+	/// A batch of uploads
+	VK_PROFILE_UPLOAD,
+	VK_PROFILE_STAGE_LEN
+};
+
+/// The number of samples each stage's statistics cover, and how often they are reported
+#define VK_PROFILE_WINDOW 120
+/// Timestamps written by each frame: its start, the end of its render pass and the end of its readback
+#define VK_PROFILE_FRAME_QUERIES 3
+
+/// The most recent GPU times of one stage in milliseconds
+struct vk_profile_samples {
+	double samples[VK_PROFILE_WINDOW];
+	uint32_t sample_len;
+	/// Where the next sample goes, overwriting the oldest once the window is full
+	uint32_t next;
+	/// Samples added since the stage was last reported
+	uint32_t unreported;
+};
+
+/// A summary of a stage's recent GPU times in milliseconds, all zero before its first sample
+struct vk_profile_summary {
+	double last;
+	double mean;
+	double min;
+	double max;
+	uint32_t sample_len;
+};
+
+/// Results are read once the fence of the work that wrote them has signalled, so profiling never stalls
+struct vk_profiler {
+	bool enabled;
+	/// Nanoseconds per timestamp tick
+	float period;
+	/// The valid bits of timestamps on the graphics queue and on the upload queue.
+	/// The upload mask is 0 when uploads are untimed.
+	uint64_t graphics_mask;
+	uint64_t upload_mask;
+	/// Two timestamps per upload slot
+	VkQueryPool upload_queries;
+	/// Whether upload slots are reset from the host through VK_EXT_host_query_reset, as transfer-only queues cannot reset queries
+	bool host_reset;
+	PFN_vkResetQueryPoolEXT reset_query_pool;
+	struct vk_profile_samples stages[VK_PROFILE_STAGE_LEN];
 };
 
 #define VK_MAX_INFLIGHT 2
+/// The maximum number of glyphs each glyph instance buffer holds.
+/// vk_draw_glyphs drops glyphs beyond it, warning the first time.
+#define VK_MAX_GLYPH_INSTANCES 16384
+/// Swapchains an output may have replaced before their last frames finish
+#define VK_MAX_RETIRED_SWAPCHAINS 4
 
+/// A frame context, reused once its fence shows the GPU is done with the previous frame in it
 typedef struct vk_inflight {
+	/// Reset in bulk every frame. Each output has its own slots, so outputs record in parallel without sharing a pool.
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
 	VkSemaphore render_semaphore;
 	VkSemaphore present_semaphore;
 	VkFence fence;
+	/// The output frame number last given to this slot, so retired swapchains and layers know when they are idle
+	uint64_t frame;
+	/// The graphics submission serial of the slot's last submitted frame, so the deletion queue knows what has completed
+	uint64_t submit_serial;
+	/// Only created when profiling
+	VkQueryPool query_pool;
+	/// Whether the slot's last submission wrote timestamps that have not been read yet
+	bool profiled;
 } InFlight;
 
+/// One recording of a layer, replayed by later frames for as long as its content is unchanged
+struct vk_layer_recording {
+	VkCommandBuffer command_buffer;
+	/// Persistently mapped glyph instances, owned by the recording because every replay reads them again
+	VkBuffer glyph_instance_buffer;
+	struct vk_allocation glyph_instance_memory;
+	struct vk_glyph_instance* glyph_instances;
+	uint32_t glyph_instance_len;
+
+	/// What the recording was made against, any of which changing means recording again
+	uint64_t serial;
+	VkExtent2D extent;
+	uint64_t atlas_generation;
+	bool recorded;
+	/// The transfer timeline value the recording's draws need, so frames only wait for uploads they sample
+	uint64_t upload_value;
+	/// The last frame of the output to execute it
+	uint64_t last_frame;
+};
+
+/// Offscreen rendering in place of a display, for benchmarking and pixel tests
+struct vk_headless {
+	bool enabled;
+	/// Copies every frame into host memory for vk_headless_readback, set when a capture is requested
+	bool readback;
+	/// Frames drawn before the compositor reports their average draw time and exits, or 0 to run until stopped
+	uint64_t frame_limit;
+	/// Where the last frame of a limited run is written as a binary PPM image, or NULL
+	const char* capture_path;
+	VkExtent2D extent;
+	/// In millihertz, like display refresh rates
+	uint32_t refresh_rate;
+};
+
+enum vk_mode_policy {
+	/// The display's physical resolution at its highest refresh rate
+	VK_MODE_NATIVE,
+	/// The highest refresh rate at the largest resolution offering it
+	VK_MODE_REFRESH,
+	/// A configured resolution at the refresh rate closest to the configured one
+	VK_MODE_EXPLICIT
+};
+
+/// How a display mode is chosen, read from WAYVK_MODE
+struct vk_mode_config {
+	enum vk_mode_policy policy;
+	/// Only used by VK_MODE_EXPLICIT
+	uint32_t width;
+	uint32_t height;
+	/// In millihertz, or 0 for the highest available
+	uint32_t refresh_rate;
+};
+
+/// A swapchain replaced while frames rendering to it may still be executing
+struct vk_retired_swapchain {
+	VkSwapchainKHR swapchain;
+	uint32_t image_len;
+	Image* images;
+	VkFramebuffer* framebuffers;
+	/// Destroyed once this frame of its output has finished
+	uint64_t last_frame;
+};
+
+/// A display with its own swapchain and frames, or an offscreen stand-in when headless
+typedef struct vk_output {
+	VkDisplayKHR display;
+	VkDisplayPropertiesKHR display_properties;
+	uint32_t display_plane;
+	uint32_t display_stack;
+	VkDisplayModeKHR display_mode;
+	VkDisplayModeParametersKHR display_mode_params;
+	/// Set by vk_output_request_mode and consumed by the render thread at a frame boundary, both under mode_mutex
+	struct vk_mode_config mode_request;
+	atomic_bool mode_pending;
+	pthread_mutex_t mode_mutex;
+
+	VkSurfaceKHR surface;
+	VkSurfaceCapabilitiesKHR surface_capabilities;
+	VkPresentModeKHR present_mode;
+	VkSwapchainKHR swapchain;
+	VkExtent2D swapchain_extent;
+	uint32_t swapchain_image_len;
+	Image* swapchain_images;
+	/// Created on the first frame to use each image, VK_NULL_HANDLE until then
+	VkFramebuffer* framebuffers;
+	/// Set when acquire or present reports the swapchain no longer matches the display
+	bool swapchain_stale;
+	/// Set when the display has gone away, after which no more frames begin
+	bool lost;
+	struct vk_retired_swapchain retired[VK_MAX_RETIRED_SWAPCHAINS];
+	uint32_t retired_len;
+
+	InFlight inflight[VK_MAX_INFLIGHT];
+	uint_fast8_t current_inflight;
+	uint64_t frame_count;
+
+	/// Only used when headless, where the swapchain images are offscreen images
+	struct vk_allocation* image_memory;
+	VkBuffer* readback_buffers;
+	struct vk_allocation* readback_memory;
+} Output;
+
 typedef struct vk {
 	Font ft;
+	/// Guards the queue and the shared device state, only held through vk_lease_acquire
 	pthread_mutex_t mutex;
 
+	/// When vk_setup began, for startup timings
+	struct timespec startup_time;
 	VkInstance instance;
 	VkPhysicalDevice physical_device;
 	VkPhysicalDeviceMemoryProperties physical_device_memory_properties;
+	struct vk_allocator allocator;
 	uint32_t queue_family;
 	VkQueue queue;
 	VkDevice device;
-	VkSurfaceKHR surface;
-	VkSwapchainKHR swapchain;
-	uint32_t swapchain_image_len;
-	Image* swapchain_images;
-	VkFramebuffer* framebuffers;
+	/// Every output shares the surface format, so they can share the renderpass and pipelines
+	VkSurfaceFormatKHR surface_format;
 	VkRenderPass renderpass;
+	/// Only used for uploads, which are recorded under the lease
 	VkCommandPool command_pool;
-	VkCommandBuffer* command_buffers;
+	struct vk_transfer transfer;
+	/// Bumped for every frame submitted to the graphics queue
+	uint64_t submit_serial;
+	struct vk_deletion_queue deletions;
+	struct vk_profiler profiler;
 
-	InFlight inflight[VK_MAX_INFLIGHT];
-	uint_fast8_t current_inflight;
+	Output* outputs;
+	uint32_t output_len;
 
-	VkDisplayKHR display;
-	VkDisplayPropertiesKHR display_properties;
-	uint32_t display_plane;
-	uint32_t display_stack;
-	VkDisplayModeKHR display_mode;
-	VkDisplayModeParametersKHR display_mode_params;
+	/// Whether VK_EXT_display_control is enabled, allowing vblank events to be waited on
+	bool display_control;
+	PFN_vkRegisterDisplayEventEXT register_display_event;
 
-	VkSurfaceCapabilitiesKHR surface_capabilities;
-	VkSurfaceFormatKHR surface_format;
-	VkPresentModeKHR present_mode;
-	VkExtent2D swapchain_extent;
+	/// When enabled there is a single offscreen output and no display, surface or swapchain
+	struct vk_headless headless;
+	struct vk_mode_config mode_config;
+
+	/// Every pipeline is created through this, so later boots skip shader compilation
+	VkPipelineCache pipeline_cache;
+	/// Where the cache is saved, keyed by device and driver, or NULL without a cache directory
+	char* pipeline_cache_path;
+	/// Whether the cache started out with data from a previous boot
+	bool pipeline_cache_warm;
 
+	struct vk_bindless bindless;
 	struct vk_glyph_pipeline glyph_pipeline;
+	struct vk_glyph_atlas glyph_atlas;
+	struct vk_upload_ring upload_ring;
 } Vulkan;
 
 Vulkan vk_setup(void);
 void vk_cleanup(Vulkan*);
 
+/// Leases the queue and device for recording and submitting GPU work.
+/// Sessions must not hold a lease during work that does not touch Vulkan.
+void vk_lease_acquire(Vulkan*);
+void vk_lease_release(Vulkan*);
+
+/// The most layers a single frame can execute
+#define VK_MAX_FRAME_LAYERS 4
+
+/// A frame being recorded for presentation, or a layer being recorded into one
+struct vk_frame {
+	Output* output;
+	InFlight* inflight;
+	uint32_t image_index;
+	VkCommandBuffer command_buffer;
+	VkFramebuffer framebuffer;
+	VkExtent2D extent;
+	/// Secondary command buffers that vk_frame_end executes inside the render pass, in order
+	VkCommandBuffer layers[VK_MAX_FRAME_LAYERS];
+	struct vk_layer_recording* layer_recordings[VK_MAX_FRAME_LAYERS];
+	uint32_t layer_len;
+	/// Only set while recording a layer, which is where drawn glyphs go
+	struct vk_layer_recording* recording;
+};
+
+/// Part of an output's frame, such as a session's content, recorded into secondary command buffers
+/// by the thread that owns the content while the output thread only executes them
+typedef struct vk_layer {
+	Output* output;
+	/// Layers record on different threads, so each has its own pool
+	VkCommandPool command_pool;
+	/// Enough that a new recording never overwrites one a pending frame may still execute
+	struct vk_layer_recording recordings[VK_MAX_INFLIGHT];
+	uint32_t current;
+} Layer;
+
+/// Waits for the output's next in-flight slot, acquires a swapchain image, resets the slot's command pool and begins its command buffer and render pass.
+/// Returns false without touching the frame if no image is available or the display is gone.
+/// Rebuilds the swapchain first if it went stale, retrying once if the acquire finds it out of date.
+/// Does not require a lease, but only one thread may begin frames for each output.
+bool vk_frame_begin(Vulkan*, Output*, struct vk_frame*);
+/// Executes the frame's layers, ends the render pass and command buffer, submits it and presents the image. Requires a lease.
+/// Returns false if a layer recorded before a glyph atlas reset had to be left out, in which case the frame should be drawn again.
+bool vk_frame_end(Vulkan*, struct vk_frame*);
+/// Both require a lease
+Layer* vk_layer_setup(Vulkan*, Output*);
+void vk_layer_cleanup(Vulkan*, Layer*);
+/// Adds the layer to the frame. If `reusable` and nothing it was recorded against changed since, the last recording is replayed and false is returned.
+/// Otherwise returns true with `layer_frame` set up to record the layer, which vk_layer_end finishes. Only call from the output's render thread.
+bool vk_layer_begin(Vulkan*, Layer*, struct vk_frame* frame, uint64_t serial, bool reusable, struct vk_frame* layer_frame);
+void vk_layer_end(Vulkan*, struct vk_frame* layer_frame);
+/// The size of the frame's image, for code that only sees the frame as an opaque pointer
+VkExtent2D vk_frame_extent(struct vk_frame*);
+/// Asks the output's render thread to switch display mode, without disturbing the sessions.
+/// Only the main thread may request mode changes.
+void vk_output_request_mode(Output*, struct vk_mode_config);
+/// Rebuilds the output's surface and swapchain if a mode change is pending and selects a different mode.
+/// Returns true if the mode changed. Only call from the output's render thread between frames.
+bool vk_output_apply_mode(Vulkan*, Output*);
+/// Waits for the last submitted headless frame and returns its pixels as tightly packed B8G8R8A8 rows,
+/// or NULL when readback is disabled. Requires a lease.
+const uint8_t* vk_headless_readback(Vulkan*, Output*);
+
 InFlight vk_inflight_setup(Vulkan*);
 void vk_inflight_cleanup(Vulkan*, InFlight*);
 
 uint32_t vk_find_memory_type(Vulkan* vk, uint32_t memory_types, VkMemoryPropertyFlags memory_properties);
 
-bool load_shader(const char* path, uint8_t** shader_data, size_t* shader_len);
+/// Sub-allocates memory satisfying the requirements. `linear` is set for buffers and linearly tiled images.
+/// Requires a lease.
+struct vk_allocation vk_memory_alloc(Vulkan*, VkMemoryRequirements, VkMemoryPropertyFlags, bool linear);
+void vk_memory_free(Vulkan*, struct vk_allocation*);
+/// Allocates and binds memory for a buffer
+struct vk_allocation vk_memory_bind_buffer(Vulkan*, VkBuffer, VkMemoryPropertyFlags);
+/// Allocates and binds memory for an optimally tiled image
+struct vk_allocation vk_memory_bind_image(Vulkan*, VkImage, VkMemoryPropertyFlags);
+/// Returns unused blocks to the driver.
+/// Live allocations are not moved, as their resources would have to be recreated and rebound.
+void vk_memory_defragment(Vulkan*);
 
+/// Both require a lease. Freed sets are recycled by later allocations, so the caller must make sure no pending
+/// command buffer still uses a set before freeing it, and must write every binding of an allocated set before use.
+VkDescriptorSet vk_descriptor_alloc(Vulkan*, struct vk_descriptor_allocator*);
+void vk_descriptor_free(struct vk_descriptor_allocator*, VkDescriptorSet);
+
+/// Stores the view in the bindless texture array and returns its element, which draws select the texture by.
+/// The view must be in the given layout when sampled. Requires a lease and bindless textures.
+uint32_t vk_bindless_texture_add(Vulkan*, VkImageView, VkImageLayout);
+/// Frees the element for reuse. No pending command buffer may still sample it. Requires a lease.
+void vk_bindless_texture_remove(Vulkan*, uint32_t texture);
+
+/// Releases the resource once every frame and upload submitted so far has completed, without waiting for the GPU.
+/// The caller must already have stopped recording new uses of it. Requires a lease.
+void vk_defer_deletion(Vulkan*, struct vk_deletion);
+/// Releases deferred resources whose last users have completed. Called after every frame submission.
+/// With `idle` set, the device must be idle and everything is released. Requires a lease.
+void vk_deletion_collect(Vulkan*, bool idle);
+
+/// Summarises the stage's recent GPU times. Requires a lease.
+struct vk_profile_summary vk_profile_summary(Vulkan*, enum vk_profile_stage);
+
+/// Creates a module from a shader embedded by build.sh, named after its source file in shader/
+VkShaderModule vk_shader_module_create(Vulkan*, const char* name);
+
+/// A region of the upload ring
 struct vk_staging_buffer {
 	VkBuffer buffer;
-	VkDeviceMemory memory;
-	VkMemoryRequirements memory_requirements;
+	VkDeviceSize offset;
 	uint32_t buffer_len;
 };
 
+/// The location of a glyph in the atlas
 struct vk_glyph {
-	VkImage image;
-	VkImageView view;
-	VkSampler sampler;
-	VkDeviceMemory memory;
-	VkMemoryRequirements memory_requirements;
-	VkDescriptorSet descriptor;
+	uint32_t page;
+	/// Normalised texture coordinates of the glyph within its page
+	float u;
+	float v;
+	float uv_width;
+	float uv_height;
 };
 
-// Copies data to a buffer in GPU memory
+/// Copies data into the upload ring. The region is reclaimed once the next transfer to be submitted completes.
+/// Requires a lease.
 struct vk_staging_buffer vk_staging_buffer_create(Vulkan*, void* data, size_t data_len);
-void vk_staging_buffer_destroy(Vulkan*, struct vk_staging_buffer*);
+/// Whether data can be staged without first submitting the transfer being recorded, whose regions cannot be reclaimed yet.
+/// Requires a lease.
+bool vk_staging_buffer_fits(Vulkan*, size_t data_len);
 /// Initiates a transfer command buffer for a series of buffer transfers
 VkCommandBuffer vk_staging_buffer_start_transfer(Vulkan*);
-/// Submits buffer transfers to the queue and waits for completion
+/// Submits buffer transfers without waiting for them to complete.
+/// Frames that sample what they wrote wait for them, either through the transfer timeline or the barriers they record.
 void vk_staging_buffer_end_transfer(Vulkan*, VkCommandBuffer);
 
-struct vk_glyph_push_constant {
-	float x;
-	float y;
-	float width;
-	float height;
-};
-
-struct vk_glyph vk_create_glyph(Vulkan*, struct vk_staging_buffer*, VkCommandBuffer, uint32_t width, uint32_t height);
-void vk_destroy_glyph(Vulkan*, struct vk_glyph*);
-void vk_draw_glyph(Vulkan*, struct vk_glyph*, struct vk_glyph_push_constant, uint32_t image_index);
\ No newline at end of file
+/// Packs a glyph into the atlas, recording the upload of its staged bitmap into the transfer buffer.
+/// A new page is added when the glyph does not fit in any existing page.
+struct vk_glyph vk_glyph_atlas_insert(Vulkan*, struct vk_staging_buffer*, VkCommandBuffer, uint32_t width, uint32_t height);
+/// Empties the atlas so it can be repacked. Every previously inserted glyph becomes invalid.
+/// The old pages are released through the deletion queue, so frames in flight keep sampling them without a stall.
+void vk_glyph_atlas_reset(Vulkan*);
+/// Draws every instance into the layer being recorded with a single draw call. All of them must sample from the same atlas page.
+/// Instances past VK_MAX_GLYPH_INSTANCES are dropped.
+void vk_draw_glyphs(Vulkan*, struct vk_frame*, uint32_t page, const struct vk_glyph_instance* instances, uint32_t instance_len);
\ No newline at end of file
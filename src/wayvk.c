@@ -2,12 +2,14 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <poll.h>
+#include <stdatomic.h>
 
 #include <libudev.h>
 #include <libinput.h>
 
 #include "vk.h"
+#include "output.h"
+#include "reactor.h"
 #include "session/session.h"
 #include "session/wl.h"
 #include "session/error.h"
@@ -55,6 +57,8 @@ enum keys {
 	KEY_F8 = 66,
 	KEY_F9 = 67,
 	KEY_F10 = 68,
+	KEY_F11 = 87,
+	KEY_F12 = 88,
 
 	KEY_RCTRL = 97,
 	KEY_RALT = 100,
@@ -65,129 +69,197 @@ const struct session* default_sessions[] = {
 	&wl_session,
 	&error_session
 };
+#define sessions_len (sizeof(default_sessions) / sizeof(struct session*))
 
-int main(void) {
-	srand(17);
+struct compositor {
+	Vulkan* vk;
+	struct libinput* li;
 
-	Vulkan vk = vk_setup();
-	vk_cleanup(&vk);
-	return 0;
+	SessionHandler* sessions[sessions_len];
+	/// Read by the output render threads
+	atomic_uint_fast8_t active_session;
+	uint_fast8_t key_modifiers;
+	bool running;
+};
 
-	struct udev* udev = udev_new();
-	struct libinput* li = libinput_udev_create_context(&input_callbacks, NULL, udev);
-	libinput_udev_assign_seat(li, "seat0");
+static void handle_input(int fd, uint32_t events, void* data) {
+	struct compositor* compositor = data;
+	SessionHandler** sessions = compositor->sessions;
 	struct libinput_event* li_event;
 
-	uint_fast8_t key_modifiers = 0;
-
-	SessionHandler* sessions[sizeof(default_sessions) / sizeof(struct session*)];
-	#define sessions_len (sizeof(sessions) / sizeof(SessionHandler*))
-	uint_fast8_t active_session = 0;
+	libinput_dispatch(compositor->li);
+	while ((li_event = libinput_get_event(compositor->li))) {
+		switch (libinput_event_get_type(li_event)) {
+		case LIBINPUT_EVENT_KEYBOARD_KEY:{
+			struct libinput_event_keyboard* li_key_event = libinput_event_get_keyboard_event(li_event);
+			uint32_t key_code = libinput_event_keyboard_get_key(li_key_event);
+			enum libinput_key_state key_state = libinput_event_keyboard_get_key_state(li_key_event);
+			uint_least8_t modifier_bitmask = 0;
+			switch (key_code) {
+				case KEY_LCTRL:
+					modifier_bitmask = MODIFIER_LCTRL;
+					break;
+				case KEY_RCTRL:
+					modifier_bitmask = MODIFIER_RCTRL;
+					break;
+				case KEY_LALT:
+					modifier_bitmask = MODIFIER_LALT;
+					break;
+				case KEY_RALT:
+					modifier_bitmask = MODIFIER_RALT;
+					break;
+				case KEY_SHIFT:
+					modifier_bitmask = MODIFIER_SHIFT;
+					break;
+				case KEY_ESC:
+					modifier_bitmask = MODIFIER_ESC;
+					break;
+				case KEY_CMD:
+					modifier_bitmask = MODIFIER_CMD;
+					break;
+				default:
+					break;
+			}
+			
+			if (modifier_bitmask) {
+				// TODO - Handle multi-device cases
+				if (key_state == LIBINPUT_KEY_STATE_PRESSED)
+					compositor->key_modifiers |= modifier_bitmask;
+				else if (key_state == LIBINPUT_KEY_STATE_RELEASED)
+					compositor->key_modifiers &= !modifier_bitmask;
+				break;
+			}
 
-	// Initialise all the sessions
-	for (size_t index = 0; index < sessions_len; index++)
-		sessions[index] = session_setup(&vk, default_sessions[index]);
-
-	bool running = true;
-	while (running) {
-		libinput_dispatch(li);
-		while ((li_event = libinput_get_event(li))) {
-			switch (libinput_event_get_type(li_event)) {
-			case LIBINPUT_EVENT_KEYBOARD_KEY:{
-				struct libinput_event_keyboard* li_key_event = libinput_event_get_keyboard_event(li_event);
-				uint32_t key_code = libinput_event_keyboard_get_key(li_key_event);
-				enum libinput_key_state key_state = libinput_event_keyboard_get_key_state(li_key_event);
-				uint_least8_t modifier_bitmask = 0;
+			// Key press events
+			if (key_state == LIBINPUT_KEY_STATE_PRESSED) {
 				switch (key_code) {
-					case KEY_LCTRL:
-						modifier_bitmask = MODIFIER_LCTRL;
-						break;
-					case KEY_RCTRL:
-						modifier_bitmask = MODIFIER_RCTRL;
-						break;
-					case KEY_LALT:
-						modifier_bitmask = MODIFIER_LALT;
-						break;
-					case KEY_RALT:
-						modifier_bitmask = MODIFIER_RALT;
+					case KEY_Q:
+						if (compositor->key_modifiers == (MODIFIER_SHIFT | MODKEY)) {
+							compositor->running = false;
+						}
 						break;
-					case KEY_SHIFT:
-						modifier_bitmask = MODIFIER_SHIFT;
-						break;
-					case KEY_ESC:
-						modifier_bitmask = MODIFIER_ESC;
-						break;
-					case KEY_CMD:
-						modifier_bitmask = MODIFIER_CMD;
-						break;
-					default:
-						break;
-				}
-				
-				if (modifier_bitmask) {
-					// TODO - Handle multi-device cases
-					if (key_state == LIBINPUT_KEY_STATE_PRESSED)
-						key_modifiers |= modifier_bitmask;
-					else if (key_state == LIBINPUT_KEY_STATE_RELEASED)
-						key_modifiers &= !modifier_bitmask;
-					break;
-				}
-
-				// Key press events
-				if (key_state == LIBINPUT_KEY_STATE_PRESSED) {
-					switch (key_code) {
-						case KEY_Q:
-							if (key_modifiers == (MODIFIER_SHIFT | MODKEY)) {
-								running = false;
-							}
-							break;
-						case KEY_F1:
-						case KEY_F2:
-						case KEY_F3:
-						case KEY_F4:
-						case KEY_F5:
-						case KEY_F6:
-						case KEY_F7:
-						case KEY_F8:
-						case KEY_F9:
-						case KEY_F10:
-							if (key_modifiers == MODKEY) {
-								uint_fast8_t session = key_code - KEY_F1;
-								if (session < sessions_len)
-									active_session = session;
+					case KEY_F11:
+					case KEY_F12:
+						// Switch every display to its native or its highest refresh mode
+						if (compositor->key_modifiers == MODKEY) {
+							struct vk_mode_config mode = { .policy = key_code == KEY_F11 ? VK_MODE_NATIVE : VK_MODE_REFRESH };
+							for (uint32_t index = 0; index < compositor->vk->output_len; index++)
+								vk_output_request_mode(&compositor->vk->outputs[index], mode);
+						}
+						// Falls through to be forwarded like the session keys, which F11 and F12 never select
+					case KEY_F1:
+					case KEY_F2:
+					case KEY_F3:
+					case KEY_F4:
+					case KEY_F5:
+					case KEY_F6:
+					case KEY_F7:
+					case KEY_F8:
+					case KEY_F9:
+					case KEY_F10:
+						if (compositor->key_modifiers == MODKEY) {
+							uint_fast8_t session = key_code - KEY_F1;
+							if (session < sessions_len && session != compositor->active_session) {
+								session_hide(sessions[compositor->active_session]);
+								compositor->active_session = session;
+								session_show(sessions[session]);
 							}
-						default: {
-							struct session_event_key key_event = {
-								.key = key_code,
-								.modifiers = key_modifiers
-							};
-							session_execute(sessions[active_session], (fn_session_generic)sessions[active_session]->session->key_event, &key_event);
-						} break;
-					}
+						}
+					default: {
+						struct session_event_key key_event = {
+							.key = key_code,
+							.modifiers = compositor->key_modifiers
+						};
+						SessionHandler* active = sessions[compositor->active_session];
+						session_execute(active, (fn_session_generic)active->session->key_event, &key_event, sizeof(key_event));
+					} break;
 				}
-
-				break;
 			}
-			default:
-				break;
-			}
-			libinput_event_destroy(li_event);
+
+			break;
+		}
+		default:
+			break;
 		}
+		libinput_event_destroy(li_event);
+	}
+}
+
+static void handle_headless_finished(int fd, uint32_t events, void* data) {
+	struct compositor* compositor = data;
+	compositor->running = false;
+}
+
+static void handle_session_events(int fd, uint32_t events, void* data) {
+	SessionHandler* handler = data;
+	session_execute(handler, (fn_session_generic)handler->session->background_update, NULL, 0);
+}
+
+int main(void) {
+	srand(17);
+
+	Vulkan vk = vk_setup();
+	Reactor reactor = reactor_setup();
 
-		// Update the active session
-		session_execute(sessions[active_session], (fn_session_generic)sessions[active_session]->session->update, NULL);
-		// Background updates for other sessions
+	struct udev* udev = udev_new();
+	struct compositor compositor = {
+		.vk = &vk,
+		.li = libinput_udev_create_context(&input_callbacks, NULL, udev),
+		.active_session = 0,
+		.key_modifiers = 0,
+		.running = true
+	};
+	libinput_udev_assign_seat(compositor.li, "seat0");
+
+	// Initialise all the sessions
+	for (size_t index = 0; index < sessions_len; index++)
+		compositor.sessions[index] = session_setup(&vk, default_sessions[index]);
+	// Limited headless runs have nobody to switch sessions, so they show the first one that draws
+	if (vk.headless.frame_limit)
 		for (size_t index = 0; index < sessions_len; index++)
-			if (index != active_session && sessions[index]->session->background_update)
-				session_execute(sessions[index], (fn_session_generic)sessions[index]->session->background_update, NULL);
+			if (default_sessions[index]->render) {
+				compositor.active_session = index;
+				break;
+			}
+	session_show(compositor.sessions[compositor.active_session]);
+
+	// Every output renders on its own thread. The first also paces session updates.
+	OutputRenderer* renderers[vk.output_len];
+	for (uint32_t index = 0; index < vk.output_len; index++)
+		renderers[index] = output_renderer_setup(&vk, &vk.outputs[index], compositor.sessions, sessions_len, &compositor.active_session, index == 0);
+
+	struct reactor_source* input_source = reactor_add(&reactor, libinput_get_fd(compositor.li), EPOLLIN, handle_input, &compositor);
+	// The single headless output stops the compositor once its frames are drawn
+	struct reactor_source* headless_source = NULL;
+	if (vk.headless.frame_limit)
+		headless_source = reactor_add(&reactor, renderers[0]->finished_fd, EPOLLIN, handle_headless_finished, &compositor);
+	struct reactor_source* session_sources[sessions_len] = { NULL };
+	for (size_t index = 0; index < sessions_len; index++) {
+		SessionHandler* handler = compositor.sessions[index];
+		// Edge triggered as the fd stays readable until the session thread gets around to dispatching
+		if (handler->session->event_fd && handler->session->background_update)
+			session_sources[index] = reactor_add(&reactor, handler->session->event_fd(handler->data), EPOLLIN | EPOLLET, handle_session_events, handler);
 	}
 
+	// Sleep until input arrives or a session has events
+	while (compositor.running)
+		reactor_dispatch(&reactor, -1);
+
+	for (size_t index = 0; index < sessions_len; index++)
+		if (session_sources[index])
+			reactor_remove(&reactor, session_sources[index]);
+	if (headless_source)
+		reactor_remove(&reactor, headless_source);
+	reactor_remove(&reactor, input_source);
+	for (uint32_t index = 0; index < vk.output_len; index++)
+		output_renderer_cleanup(renderers[index]);
 	for (size_t index = 0; index < sessions_len; index++)
-		session_cleanup(sessions[index]);
+		session_cleanup(compositor.sessions[index]);
 	vkDeviceWaitIdle(vk.device);
 	vk_cleanup(&vk);
 
-	libinput_unref(li);
+	libinput_unref(compositor.li);
+	reactor_cleanup(&reactor);
 
 	return 0;
-}
+}
\ No newline at end of file